@@ -0,0 +1,39 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _ALLOC_COUNTER_H
+#define _ALLOC_COUNTER_H
+
+#include <cstddef>
+
+namespace anagram {
+
+// GetThreadAllocations
+// Every heap allocation (operator new) is counted against the thread that
+// makes it, so that a search thread can tell how many allocations a stretch
+// of its own work made, undisturbed by the other threads.
+// Exit: # of allocations made so far by the calling thread
+size_t GetThreadAllocations();
+} // namespace anagram
+
+#endif // #ifndef _ALLOC_COUNTER_H
@@ -0,0 +1,196 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _ALPHABET_H_
+#define _ALPHABET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace anagram {
+
+// Alphabet descriptors
+// An alphabet maps the characters of a word onto a dense range of "lanes",
+// 0..kLanes-1, which the histograms use as array indexes.  Each descriptor
+// provides:
+//  kLanes       compile-time upper bound on the # of lanes
+//  LaneCount()  # of lanes actually in use
+//  PaddedLaneCount()
+//               LaneCount() rounded up for whole-vector loops; lanes past
+//               LaneCount() are always zero in a histogram
+//  Lane(p)      consumes one character at p (advancing p) and returns its
+//               lane, kSkipLane for separators or kForeignLane for a
+//               character the alphabet cannot represent.
+// Histograms are templated on the descriptor, so the lane mapping is inlined
+// into the counting loops.
+
+const size_t kSkipLane = (size_t) -1;
+const size_t kForeignLane = (size_t) -2;
+
+// AlphabetId
+// Run-time tag for the alphabet chosen for a query.
+enum AlphabetId {
+  ALPHABET_ENGLISH = 0,
+  ALPHABET_LATIN1,
+  ALPHABET_UTF8
+};
+
+// EnglishAlphabet
+// The letters a-z (either case) in 26 lanes.  Histogram storage is padded
+// to kPaddedLanes so a full 8-bit histogram is one 32-byte vector.
+struct EnglishAlphabet {
+  static const size_t kLanes = 26;
+  static const size_t kPaddedLanes = 32;
+  static inline size_t LaneCount() { return kLanes; }
+  static inline size_t PaddedLaneCount() { return kPaddedLanes; }
+  static inline size_t Lane(const char *& p) {
+    unsigned char c = (unsigned char) *p++;
+    if (c >= 'a' && c <= 'z')
+      return c - 'a';
+    if (c >= 'A' && c <= 'Z')
+      return c - 'A';
+    return ' ' == c ? kSkipLane : kForeignLane;
+  }
+};
+
+// Latin1Alphabet
+// One lane per byte value.  Bytes are treated as unsigned, so 8-bit text
+// never produces a negative index.
+struct Latin1Alphabet {
+  static const size_t kLanes = 256;
+  static const size_t kPaddedLanes = 256;
+  static inline size_t LaneCount() { return kLanes; }
+  static inline size_t PaddedLaneCount() { return kPaddedLanes; }
+  static inline size_t Lane(const char *& p) {
+    unsigned char c = (unsigned char) *p++;
+    return ' ' == c ? kSkipLane : (size_t) c;
+  }
+};
+
+// Utf8Alphabet
+// A per-dictionary dense remap of UTF-8 code points.  Lanes are handed out
+// in order of first appearance as the dictionary is loaded (Register), so a
+// dictionary that uses, say, 40 distinct letters gets 40 lanes no matter
+// where those letters live in Unicode.  The remap is built single-threaded
+// before any search starts and is read-only afterwards.
+class Utf8Alphabet {
+ public:
+  static const size_t kLanes = 256;
+  static const size_t kPaddedLanes = 256;
+  static inline size_t LaneCount() { return lane_tot_; }
+  static inline size_t PaddedLaneCount() { return (lane_tot_ + 31) & ~31; }
+  static inline size_t Lane(const char *& p) {
+    uint32_t cp = Decode(p);
+    if (' ' == cp)
+      return kSkipLane;
+    if (cp < kTableSize)
+      return ToLane(table_[cp]);
+    return LookupExtended(cp);
+  }
+  static void Register(const char *word);
+
+ private:
+  static const size_t kTableSize = 0x10000; // Basic Multilingual Plane
+
+  // Table entries hold lane + 1; zero (the initial state) means foreign.
+  static inline size_t ToLane(uint16_t entry) {
+    return entry ? (size_t) entry - 1 : kForeignLane;
+  }
+  // Decode
+  // Decodes one UTF-8 sequence.  Malformed bytes decode as themselves, as
+  // if the text were Latin-1, and never advance past a terminator.
+  static inline uint32_t Decode(const char *& p) {
+    unsigned char c = (unsigned char) *p++;
+    if (c < 0x80)
+      return c;
+    size_t extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+    uint32_t cp = c & (0x3f >> extra);
+    for (size_t i = 0; i < extra; ++i) {
+      if ((((unsigned char) p[i]) & 0xc0) != 0x80)
+        return c;
+    }
+    for (size_t i = 0; i < extra; ++i) {
+      cp = (cp << 6) | (((unsigned char) *p++) & 0x3f);
+    }
+    return extra ? cp : c;
+  }
+  static size_t LookupExtended(uint32_t cp);
+
+  static uint16_t table_[kTableSize];
+  static size_t lane_tot_;
+};
+
+// LetterCount
+// Entry: word
+// Exit: # of letters in the word; separators are not counted and a
+//       multi-byte character counts once
+template <class Alphabet>
+size_t LetterCount(const char *word)
+{
+  size_t count = 0;
+  const char *p = word;
+  while (*p) {
+    if (kSkipLane != Alphabet::Lane(p))
+      ++count;
+  }
+  return count;
+}
+
+// SubtractLetters
+// Takes the letters of a word out of a phrase, one occurrence each, keeping
+// the rest of the phrase (separators included) in order.
+// Entry: phrase
+//        word
+//        phrase left over
+// Exit: true == the phrase had every letter of the word
+template <class Alphabet>
+bool SubtractLetters(const char *phrase, const char *word, std::string *rest)
+{
+  *rest = phrase;
+  const char *w = word;
+  while (*w) {
+    size_t lane = Alphabet::Lane(w);
+    if (kSkipLane == lane)
+      continue;
+    bool found = false;
+    const char *p = rest->c_str();
+    while (*p && !found) {
+      const char *start = p;
+      if (Alphabet::Lane(p) == lane) {
+        rest->erase(start - rest->c_str(), p - start);
+        found = true;
+      }
+    }
+    if (!found)
+      return false;
+  }
+  return true;
+}
+
+// ChooseAlphabet
+// Picks the narrowest alphabet able to represent a phrase.
+AlphabetId ChooseAlphabet(const char *phrase);
+
+} // namespace anagram
+#endif // #ifndef _ALPHABET_H_
@@ -1,14 +1,34 @@
 #ifndef _ANAGRAM_FLAGS_H_
 #define _ANAGRAM_FLAGS_H_
 
+// HistogramEngine
+// Histogram backend for the search (-t).  ENGINE_AUTO is resolved to one of
+// the others before the search starts.
+enum HistogramEngine {
+  ENGINE_AUTO = 0,
+  ENGINE_SPARSE,  // OccupancyHash: sparse index of occupied characters
+  ENGINE_DENSE    // DenseOccupancyHash: flat array over the alphabet
+};
+
 // AnagramFlags
 // This structure defines a 32-bit word of flags
 struct AnagramFlags {
-  unsigned int tree_engine : 1;
+  unsigned int engine : 2;  // HistogramEngine
   unsigned int allow_dupes : 1;
   unsigned int output_directly : 1;
   unsigned int big_dictionary: 1;
   unsigned int print_subset : 1;
+  unsigned int wide_histogram : 1;
+  unsigned int alphabet : 2;   // AlphabetId
+  unsigned int memoize : 1;
+  unsigned int rarest_first : 1;
+  unsigned int group_classes : 1;
+  unsigned int count_only : 1;
+  unsigned int fewest_first : 1;
+  unsigned int sub_words : 1;       // -a: words formable from the letters
+  unsigned int rank_by_score : 1;   // -as
+  unsigned int pattern : 1;         // -p: crossword pattern lookup
+  unsigned int complete : 1;        // -c: prefix autocomplete
 };
 
 #endif // #ifndef _ANAGRAM_FLAGS_H_
@@ -36,25 +36,19 @@ class Lock {
   ~Lock() {}
   // Acquire
   inline void Acquire() {
-    #if 1
-    while (lock_) {
-      // Occupado, sister; Force a context switch and wait our turn
-      // (TODO: Is this even necessary?)
-      sched_yield();
+    // The test-and-set is what takes the lock; checking lock_ first and
+    // setting it afterwards would let two threads in at once.
+    while (__sync_lock_test_and_set(&lock_, 1)) {
+      while (lock_) {
+        // Occupado, sister; Force a context switch and wait our turn
+        sched_yield();
+      }
     }
-    __sync_lock_test_and_set(&lock_, 1);
-    #else
-    // Low-level lock on Intel processors
-    #endif
   }
   // Release
   inline void Release() {
     // Low-level release on Intel chips
-    #if 1
-    lock_ = 0;
-    #else
     __sync_lock_release(&lock_);
-    #endif
   }
  private:
   volatile int lock_;
@@ -0,0 +1,109 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "anagram_lock.h"
+#include "output_queue.h"
+#include "work_queue.h"
+
+namespace anagram {
+
+// CheckpointTask
+// The progress of one task of the search (see SearchTask).  The one-word
+// anagrams found in a thread's part of the dictionary are task (-1, part).
+// A task over a whole first-class branch also notes each second class it
+// finishes (see Progress), so that a resumed task picks up after it.
+struct CheckpointTask {
+  bool done;
+  size_t emitted;             // results in the output, over every run
+  size_t skip;                // results already in the output, to pass over
+  std::vector< int > split;   // second classes handed off as tasks of their own
+  int resume_at;              // second class to pick up at (0 == the start)
+  size_t resume_emitted;      // results of the task before it
+};
+
+// Checkpoint
+// This class records the progress of a long search that writes its results
+// straight to a file (-o), so that a search cut short can be resumed
+// (--resume) without losing or repeating any of them.
+//
+// Progress is kept per task.  A task makes its results in the same order
+// every time it is run, so a task that was under way is run again from the
+// last second class it had finished, passing over as many results as it
+// had written since.  The classes a task handed off to other threads are
+// recorded with it, and skipped when it is run again; the tasks handed off
+// are recorded in their own right.
+//
+// Saves are made on a timer by the main thread while the search threads
+// run (see SaveIfDue), since a single task may run for hours.
+//
+// A save records the length of the output with every result counted so far
+// in it and none beyond: the queue is drained and the counts read under its
+// lock, which is also where each result is counted as it is queued.  A
+// resume cuts the output back to that length, so results written after the
+// last save are made again rather than repeated.  Saves go to a temporary
+// file renamed over the checkpoint, so that a save cut short leaves the one
+// before it intact.
+//
+// The arguments and the # of threads of the search are saved too, since
+// the tasks, and the parts of the dictionary, depend on them.
+class Checkpoint {
+ public:
+  Checkpoint(const std::string& path);
+  ~Checkpoint();
+  bool Load(std::vector< std::string > *args);
+  void SetQuery(const std::vector< std::string >& args, size_t thread_tot);
+  size_t GetThreadTot() const { return thread_tot_; }
+  long GetOutputLength() const { return output_length_; }
+  bool Resumed() const { return resumed_; }
+  void QueueTasks(size_t first, size_t end, WorkStealingQueue *work_queue);
+  CheckpointTask *Begin(const SearchTask& task);
+  void Split(CheckpointTask *parent, const SearchTask& task);
+  void Progress(CheckpointTask *task, int resume_at);
+  void Finish(CheckpointTask *task);
+  void SaveIfDue(OutputQueue *queue);
+  bool Save(OutputQueue *queue);
+  void Remove();
+ private:
+  typedef std::pair< int, int > TaskKey;   // (first, second)
+  std::string                           path_;
+  std::vector< std::string >            args_;
+  size_t                                thread_tot_;
+  long                                  output_length_;
+  bool                                  resumed_;
+  std::map< TaskKey, CheckpointTask >   tasks_;
+  Lock                                  lock_;        // guards tasks_
+  Lock                                  save_lock_;   // one save at a time
+  volatile long                         last_save_ms_;
+};
+} // namespace anagram
+
+#endif // #ifndef _CHECKPOINT_H
@@ -0,0 +1,75 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CLASS_EXPORT_H
+#define _CLASS_EXPORT_H
+
+#include <pthread.h>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dictionary_index.h"
+#include "result_shards.h"
+
+namespace anagram {
+
+// ClassExport
+// This class finds every anagram class of the dictionary at once: each set
+// of two or more single words that are anagrams of one another.
+//
+// The threads each sign their own part of the dictionary, the signature
+// being the word's letter counts (see PackSignature), and deal the signed
+// words out by a hash of the signature, so that a class lands whole with
+// one thread.  Each thread then sorts what it was dealt, lists its classes
+// and the threads merge the lists (see ResultShards).
+class ClassExport {
+ public:
+  ClassExport(const DictionaryIndex& dictionary_index, size_t thread_tot);
+  ~ClassExport();
+  bool Run(std::vector< std::string > *classes);
+  size_t GetSkipped() const { return skipped_; }
+ private:
+  typedef std::pair< std::string, size_t > SignedWord;   // signature, id
+  struct WorkerParams {
+    ClassExport *owner;
+    size_t thread_index;
+  };
+  static void *Worker(void *worker_params);
+  void Sign(size_t thread_index);
+  void Group(size_t thread_index);
+
+  const DictionaryIndex&  dictionary_index_;
+  size_t                  thread_tot_;
+  pthread_barrier_t       barrier_;
+  ResultShards            shards_;
+  std::vector< std::string > *classes_;
+  volatile long           skipped_;   // words with no signature
+  volatile bool           go_;        // the threads are all created
+  volatile bool           aborted_;   // ... or not, and are to exit
+  std::vector< std::vector< std::vector< SignedWord > > > dealt_;  // [from][to]
+};
+} // namespace anagram
+
+#endif // #ifndef _CLASS_EXPORT_H
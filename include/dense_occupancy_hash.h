@@ -0,0 +1,205 @@
+#ifndef _DENSE_OCCUPANCY_HASH_H_
+#define _DENSE_OCCUPANCY_HASH_H_
+
+#include <memory.h>
+#include <iostream>
+#include <string>
+
+#include "anagram_log.h"
+#include "alphabet.h"
+
+namespace anagram {
+
+// DenseOccupancyHash
+// An alternative histogram backend to BasicOccupancyHash with the same
+// interface.  Instead of a sparse index of the characters present it keeps a
+// flat array with one count per alphabet lane, so clear, add and compare are
+// fixed-length loops over the whole alphabet that the compiler can
+// vectorize.  For English that is 26 (padded to 32) lanes: one 8-bit
+// histogram fits in a single 256-bit register.  It wins when the alphabet is
+// small or the phrase touches a large part of it; the sparse hash wins when
+// only a few of many lanes are occupied.
+template <class Alphabet, typename CountT>
+class DenseOccupancyHash
+{
+ public:
+  typedef Alphabet alphabet_type;
+  typedef CountT count_type;
+  static const size_t kMaxUniqueChars = Alphabet::kLanes;
+
+  DenseOccupancyHash() {
+    DenseOccupancyHash::constructor_count_++;
+    memset((void *) char_count_, 0, sizeof(char_count_));
+  };
+  DenseOccupancyHash(const char *word) : DenseOccupancyHash() {
+    GetCharCountMap(word);
+  };
+  ~DenseOccupancyHash() {};
+
+  // PrintConstructorCalls
+  // Reports the # of hashes of this type constructed so far.
+  static void PrintConstructorCalls() {
+    VERBOSE_LOG(LOG_INFO, "Dense occupancy constructor calls: "
+      << DenseOccupancyHash::constructor_count_ << std::endl);
+  }
+
+  inline void clear() {
+    memset((void *) char_count_, 0,
+      Alphabet::PaddedLaneCount() * sizeof(CountT));
+  }
+
+  // AddChar
+  // Adds a single occurrence of a character.
+  // Entry: lane of the character
+  // Exit: true (a dense hash cannot run out of room)
+  inline bool AddChar(size_t index) {
+    ++char_count_[index];
+    return true;
+  }
+
+  // GetCharCount
+  // Entry: lane of the character
+  inline size_t GetCharCount(size_t index) const {
+    return (size_t) char_count_[index];
+  }
+
+  // GetMaxCharCount
+  // Exit: highest count of any single character
+  size_t GetMaxCharCount() const {
+    size_t max_count = 0;
+    const size_t lanes = Alphabet::PaddedLaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      if ((size_t) char_count_[i] > max_count)
+        max_count = (size_t) char_count_[i];
+    }
+    return max_count;
+  }
+
+  // Add one hash to the other.
+  // Entry: hash to add
+  inline void operator+=(const DenseOccupancyHash& b) {
+    const size_t lanes = Alphabet::PaddedLaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      char_count_[i] += b.char_count_[i];
+    }
+  }
+
+  // DebugOut
+  // Spit out relevant debugging info.
+  void DebugOut()
+  {
+    const size_t lanes = Alphabet::LaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      if (char_count_[i]) {
+        VERBOSE_LOG(LOG_INFO, i << "(" << (size_t) char_count_[i] << ")");
+      }
+    }
+    VERBOSE_LOG(LOG_INFO, "  unique:" << GetIndexPtr());
+    VERBOSE_LOG(LOG_INFO, std::endl);
+  }
+
+  // GetIndexPtr
+  // Exit: # of unique characters (counted; the dense hash keeps no index)
+  size_t GetIndexPtr() {
+    size_t unique = 0;
+    const size_t lanes = Alphabet::PaddedLaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      unique += char_count_[i] ? 1 : 0;
+    }
+    return unique;
+  }
+
+  // PackDifference
+  // Appends a compact encoding of this hash minus b, one count per lane in
+  // use, to key.  With this hash fixed (the master) and b a subset of it,
+  // equal keys mean equal remaining letters.
+  // Entry: b hash to subtract
+  //        key to append to
+  void PackDifference(const DenseOccupancyHash& b, std::string *key) const
+  {
+    const size_t lanes = Alphabet::LaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      CountT diff = char_count_[i] - b.char_count_[i];
+      for (size_t byte = 0; byte < sizeof(CountT); ++byte) {
+        key->push_back((char) (diff >> (byte * 8)));
+      }
+    }
+  }
+
+  // PackSubset
+  // Appends b in the encoding of PackDifference, one count per lane in use.
+  // Entry: b hash to encode
+  //        key to append to
+  void PackSubset(const DenseOccupancyHash& b, std::string *key) const
+  {
+    const size_t lanes = Alphabet::LaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      CountT count = b.char_count_[i];
+      for (size_t byte = 0; byte < sizeof(CountT); ++byte) {
+        key->push_back((char) (count >> (byte * 8)));
+      }
+    }
+  }
+
+  // Compare
+  // Same contract as BasicOccupancyHash::Compare.
+  // Entry: b hash to compare
+  // Exit: 1 == has characters not in b OR higher count of char in b
+  //       0 == same count of same characters as b (complete anagram)
+  //      -1 == all characters in b with less or equal count
+  int Compare(const DenseOccupancyHash& b)
+  {
+    // Accumulate without branching so the loop vectorizes.
+    CountT greater = 0, less = 0;
+    const size_t lanes = Alphabet::PaddedLaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      greater |= char_count_[i] > b.char_count_[i];
+      less |= char_count_[i] < b.char_count_[i];
+    }
+    if (greater)
+      return 1;
+    return less ? -1 : 0;
+  }
+
+  // IsSubset
+  // Determines if the candidate is a complete subset of b
+  // Entry: b to compare
+  // Exit: true == is complete subset
+  bool IsSubset(const DenseOccupancyHash& b)
+  {
+    CountT greater = 0;
+    const size_t lanes = Alphabet::PaddedLaneCount();
+    for (size_t i = 0; i < lanes; ++i) {
+      greater |= char_count_[i] > b.char_count_[i];
+    }
+    return !greater;
+  }
+
+  // GetCharCountMap
+  // Count the characters in a string, ignoring spaces.
+  // Entry: pointer to string
+  // Exit: false == string has a character outside the alphabet
+  bool GetCharCountMap(const char *word)
+  {
+    const char *p = word;
+    while (*p) {
+      size_t char_index = Alphabet::Lane(p);
+      if (kSkipLane == char_index)
+        continue;
+      if (kForeignLane == char_index)
+        return false;
+      ++char_count_[char_index];
+    }
+    return true;
+  }
+
+ private:
+  alignas(32) CountT char_count_[Alphabet::kPaddedLanes];
+  static int constructor_count_;
+};
+
+template <class Alphabet, typename CountT>
+int DenseOccupancyHash<Alphabet, CountT>::constructor_count_ = 0;
+
+} // namespace anagram
+#endif // #ifndef _DENSE_OCCUPANCY_HASH_H_
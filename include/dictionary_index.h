@@ -0,0 +1,235 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _DICTIONARY_INDEX_H
+#define _DICTIONARY_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "alphabet.h"
+
+namespace anagram {
+
+// DictionaryIndex
+// This class keeps the letter counts of the whole dictionary bit-sliced: for
+// each lane and count k, a bitset over the words of those with at least k
+// of that letter.  The words that fit inside a phrase are then the ones in
+// none of the "at least one more than the phrase has" slices, which is a
+// few dozen bitset AND NOTs rather than a lookup and a histogram per word.
+//
+// Words are added as the dictionary is read, once each however often they
+// appear, then Build lays out the slices for the alphabet of the query.
+// Word ids are the order the words were added in; a set of words, such as
+// those excluded from a search, is a bitset over the ids.  The index is
+// read-only once built and may be shared by any number of threads.
+class DictionaryIndex {
+ public:
+  DictionaryIndex();
+  bool Add(const char *word);
+  template <class Alphabet> void Build();
+  template <class Alphabet>
+  void FindFitting(const char *phrase, const std::vector< uint64_t >& excluded,
+    std::vector< size_t > *fitting, size_t part = 0,
+    size_t part_tot = 1) const;
+  template <class Alphabet>
+  void FindFittingWithBlanks(const char *phrase, size_t blank_tot,
+    const std::vector< uint64_t >& excluded,
+    std::vector< size_t > *fitting) const;
+  void GetWordSet(const std::vector< std::string >& words,
+    std::vector< uint64_t > *word_set) const;
+  size_t GetWordCount() const { return words_.size(); }
+  const std::string& GetWord(size_t id) const { return words_[id]; }
+  size_t GetSliceCount() const { return slice_tot_; }
+ private:
+  void Reset(size_t lane_tot);
+  void AddSlice(size_t lane);
+  static void AndNot(uint64_t *a, const uint64_t *b, size_t block_tot);
+  template <class Alphabet>
+  void CountLanes(const char *phrase, std::vector< size_t > *counts) const;
+  void CollectIds(const std::vector< uint64_t >& fit, size_t first,
+    std::vector< size_t > *ids) const;
+
+  std::vector< std::string > words_;
+  std::unordered_map< std::string, size_t > ids_;
+  size_t block_tot_;                    // 64-bit blocks per bitset
+  size_t slice_tot_;
+  std::vector< uint64_t > unusable_;    // foreign or letterless words
+  // slices_[lane][k - 1]: offset in bits_ of the words with >= k of lane
+  std::vector< std::vector< size_t > > slices_;
+  std::vector< uint64_t > bits_;
+};
+
+// Build
+// Sets up the bitsets for the alphabet.  Slices are only made for the
+// counts some word reaches.
+template <class Alphabet>
+void DictionaryIndex::Build()
+{
+  Reset(Alphabet::LaneCount());
+  std::vector< size_t > counts(Alphabet::LaneCount(), 0);
+  std::vector< size_t > touched;
+  for (size_t id = 0; id < words_.size(); ++id) {
+    uint64_t bit = (uint64_t) 1 << (id & 63);
+    size_t block = id >> 6;
+    bool foreign = false;
+    touched.clear();
+    const char *p = words_[id].c_str();
+    while (*p) {
+      size_t lane = Alphabet::Lane(p);
+      if (kSkipLane == lane)
+        continue;
+      if (kForeignLane == lane || lane >= counts.size()) {
+        foreign = true;
+        break;
+      }
+      if (!counts[lane]++)
+        touched.push_back(lane);
+    }
+    if (foreign || touched.empty()) {
+      unusable_[block] |= bit;
+    } else {
+      for (size_t lane : touched) {
+        while (slices_[lane].size() < counts[lane]) {
+          AddSlice(lane);
+        }
+        for (size_t k = 0; k < counts[lane]; ++k) {
+          bits_[slices_[lane][k] + block] |= bit;
+        }
+      }
+    }
+    for (size_t lane : touched) {
+      counts[lane] = 0;
+    }
+  }
+}
+
+// FindFitting
+// The words may be split into parts, for threads to search one each.
+// Entry: phrase
+//        words to leave out (see GetWordSet); empty == none
+//        list to fill in
+//        part of the words to search
+//        # of parts
+// Exit: ids of the words in the part whose letters are all in the phrase,
+//       as many times or fewer, ascending
+template <class Alphabet>
+void DictionaryIndex::FindFitting(
+  const char *phrase,
+  const std::vector< uint64_t >& excluded,
+  std::vector< size_t > *fitting,
+  size_t part,
+  size_t part_tot
+) const
+{
+  fitting->clear();
+  std::vector< size_t > counts;
+  CountLanes< Alphabet >(phrase, &counts);
+
+  size_t first = block_tot_ * part / part_tot;
+  size_t block_tot = block_tot_ * (part + 1) / part_tot - first;
+  std::vector< uint64_t > fit(block_tot, ~(uint64_t) 0);
+  AndNot(fit.data(), unusable_.data() + first, block_tot);
+  if (!excluded.empty())
+    AndNot(fit.data(), excluded.data() + first, block_tot);
+  for (size_t lane = 0; lane < slices_.size(); ++lane) {
+    if (counts[lane] < slices_[lane].size())
+      AndNot(fit.data(), bits_.data() + slices_[lane][counts[lane]] + first,
+        block_tot);
+  }
+
+  CollectIds(fit, first, fitting);
+}
+
+// FindFittingWithBlanks
+// Like FindFitting, but the phrase also has blanks, each of which may stand
+// for any one letter: a word fits if the letters it has beyond the phrase
+// number no more than the blanks.  Rather than trying every letter for
+// every blank, the excess of all the words is counted at once: each slice
+// at or past the phrase's count of its letter adds one to the words in it,
+// in bit-sliced counters that stop one past the # of blanks.
+// Entry: phrase (letters only)
+//        # of blanks
+//        words to leave out (see GetWordSet); empty == none
+//        list to fill in
+// Exit: ids of the words that fit, ascending
+template <class Alphabet>
+void DictionaryIndex::FindFittingWithBlanks(
+  const char *phrase,
+  size_t blank_tot,
+  const std::vector< uint64_t >& excluded,
+  std::vector< size_t > *fitting
+) const
+{
+  fitting->clear();
+  std::vector< size_t > counts;
+  CountLanes< Alphabet >(phrase, &counts);
+
+  // over[j]: the words with more than j letters beyond the phrase
+  std::vector< std::vector< uint64_t > > over(blank_tot + 1,
+    std::vector< uint64_t >(block_tot_, 0));
+  for (size_t lane = 0; lane < slices_.size(); ++lane) {
+    for (size_t k = counts[lane]; k < slices_[lane].size(); ++k) {
+      const uint64_t *slice = bits_.data() + slices_[lane][k];
+      for (size_t j = blank_tot; j > 0; --j) {
+        for (size_t block = 0; block < block_tot_; ++block) {
+          over[j][block] |= over[j - 1][block] & slice[block];
+        }
+      }
+      for (size_t block = 0; block < block_tot_; ++block) {
+        over[0][block] |= slice[block];
+      }
+    }
+  }
+
+  std::vector< uint64_t > fit(block_tot_, ~(uint64_t) 0);
+  AndNot(fit.data(), unusable_.data(), block_tot_);
+  if (!excluded.empty())
+    AndNot(fit.data(), excluded.data(), block_tot_);
+  AndNot(fit.data(), over[blank_tot].data(), block_tot_);
+  CollectIds(fit, 0, fitting);
+}
+
+// CountLanes
+// Entry: phrase
+//        counts to fill in, one per lane of the index
+template <class Alphabet>
+void DictionaryIndex::CountLanes(
+  const char *phrase,
+  std::vector< size_t > *counts
+) const
+{
+  counts->assign(slices_.size(), 0);
+  const char *p = phrase;
+  while (*p) {
+    size_t lane = Alphabet::Lane(p);
+    if (lane < counts->size())
+      ++(*counts)[lane];
+  }
+}
+} // namespace anagram
+
+#endif // #ifndef _DICTIONARY_INDEX_H
@@ -0,0 +1,82 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _MEMO_TABLE_H
+#define _MEMO_TABLE_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "anagram_lock.h"
+
+namespace anagram {
+
+// MemoSolutions
+// Every way of spelling one remaining letter multiset with partials from a
+// given start position onward.  Solutions are stored back to back as
+// partial indexes, each terminated by -1.
+struct MemoSolutions {
+  std::vector< int > words;
+  size_t count;   // # of solutions in words
+};
+typedef std::shared_ptr< const MemoSolutions > MemoEntry;
+
+// MemoTable
+// This class caches solved sub-problems of the combination search, keyed by
+// a packed encoding of the remaining letters plus the start position, so
+// that a remainder reached along several paths is only solved once.
+//
+// It is shared by all search threads and split into independently locked
+// shards.  Memory is capped: each shard gets an equal share of the byte
+// limit and evicts its oldest entries to stay within it, and entries too big
+// to be worth keeping are never stored.  Entries are reference counted, so
+// one that is evicted while a thread is still reading it stays valid.
+class MemoTable {
+ public:
+  MemoTable(size_t byte_limit);
+  ~MemoTable();
+  MemoEntry Find(const std::string& key);
+  void Insert(const std::string& key, const MemoEntry& entry);
+  void PrintStats();
+ private:
+  static const size_t kShardTot = 64;
+  struct Shard {
+    Lock lock;
+    std::unordered_map< std::string, MemoEntry > entries;
+    std::deque< std::string > order;  // insertion order, for eviction
+    size_t bytes;
+  };
+  static size_t EntryBytes(const std::string& key, const MemoEntry& entry);
+  Shard *shards_;
+  size_t shard_limit_;    // byte limit per shard
+  volatile long hits_;
+  volatile long misses_;
+  volatile long evictions_;
+};
+} // namespace anagram
+
+#endif // #ifndef _MEMO_TABLE_H
@@ -2,33 +2,52 @@
 #define  _OCCUPANCY_HASH_H_
 
 #include <memory.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
 
 #include "anagram_log.h"
+#include "alphabet.h"
 
 namespace anagram {
 
-// OccupancyHash
+// BasicOccupancyHash
 // This class maintains a sparse lookup table of counts of unique characters
 // in a string or phrase, and provides limited algebraic operations on them.
+// It is templated on the alphabet that maps characters to array lanes (see
+// alphabet.h), the width of a character count (CountT) and the maximum # of
+// unique characters it can hold (kCapacity); see the OccupancyHash and
+// WideOccupancyHash aliases below.
 // TODO: This isn't really a hash and should probably be renamed.
-class OccupancyHash
+template <class Alphabet, typename CountT, size_t kCapacity>
+class BasicOccupancyHash
 {
+  static_assert(Alphabet::kLanes <= 256, "occupancy index is limited to 8 bits");
+  static_assert(kCapacity <= Alphabet::kLanes, "capacity exceeds alphabet");
  public:
-  OccupancyHash() {
-    OccupancyHash::constructor_count_++;
-    memset((void *) occupancy_index_, 0, sizeof(occupancy_index_) * sizeof(size_t));
+  typedef Alphabet alphabet_type;
+  typedef CountT count_type;
+  static const size_t kMaxUniqueChars = kCapacity;
+
+  BasicOccupancyHash() {
+    BasicOccupancyHash::constructor_count_++;
+    memset((void *) occupancy_index_, 0, sizeof(occupancy_index_));
     memset((void *) index_index_, 0, sizeof(index_index_));
     memset((void *) char_count_, 0, sizeof(char_count_));
     index_ptr_ = 0;
   };
-  OccupancyHash(const char *word) {
-    OccupancyHash();
+  BasicOccupancyHash(const char *word) : BasicOccupancyHash() {
     GetCharCountMap(word);
   };
-  ~OccupancyHash() {};
+  ~BasicOccupancyHash() {};
+
+  // PrintConstructorCalls
+  // Reports the # of hashes of this type constructed so far.
+  static void PrintConstructorCalls() {
+    VERBOSE_LOG(LOG_INFO, "Occupancy constructor calls: "
+      << BasicOccupancyHash::constructor_count_ << std::endl);
+  }
 
-  static void PrintConstructorCalls();
   inline void clear() {
     //VERBOSE_LOG(LOG_INFO,"Clear called" << std::endl);
     while(index_ptr_) {
@@ -39,27 +58,43 @@ class OccupancyHash
     }
   }
 
-  inline void AddChar(char char_index) {
-    size_t index = (size_t) char_index;
-    ++char_count_[index];
-    size_t index_index = (size_t) index_index_[index];
-    if (index_index) {
-      ++occupancy_index_[index_index];
-    } else {
+  // AddChar
+  // Adds a single occurrence of a character.
+  // Entry: lane of the character
+  // Exit: false == character is new and the hash is at capacity
+  inline bool AddChar(size_t index) {
+    if (!char_count_[index]) {
+      if (index_ptr_ >= kCapacity)
+        return false;
       index_index_[index] = index_ptr_;
       occupancy_index_[index_ptr_] = index;
       ++index_ptr_;
     }
+    ++char_count_[index];
+    return true;
   }
 
   // GetCharCount
-  // Entry: char_index
-  inline size_t GetCharCount(char char_index) {
-    return (size_t) char_count_[ (size_t) char_index];
+  // Entry: lane of the character
+  inline size_t GetCharCount(size_t index) const {
+    return (size_t) char_count_[index];
+  }
+
+  // GetMaxCharCount
+  // Exit: highest count of any single character
+  size_t GetMaxCharCount() const {
+    size_t max_count = 0;
+    for (size_t i = 0; i < index_ptr_; ++i) {
+      size_t count = (size_t) char_count_[(size_t)occupancy_index_[i]];
+      if (count > max_count)
+        max_count = count;
+    }
+    return max_count;
   }
+
   // Add one hash to the other.
   // Entry: OccupancyHash against which to compare
-  inline void operator+=(const OccupancyHash& b) {
+  inline void operator+=(const BasicOccupancyHash& b) {
     size_t char_index;
     size_t b_index = b.index_ptr_;
     while (b_index) {
@@ -85,7 +120,7 @@ class OccupancyHash
     while (debug_index_ptr) {
       --debug_index_ptr;
       VERBOSE_LOG(LOG_INFO,
-        occupancy_index_[debug_index_ptr] << "("
+        (size_t) occupancy_index_[debug_index_ptr] << "("
         << (size_t) char_count_[(size_t)occupancy_index_[debug_index_ptr]]
         << "," << (size_t) index_index_[(size_t)occupancy_index_[debug_index_ptr]]
         << ")"
@@ -99,6 +134,59 @@ class OccupancyHash
     return index_ptr_;
   }
 
+  // PackDifference
+  // Appends a compact encoding of this hash minus b, one count per
+  // character of this hash, to key.  With this hash fixed (the master) and b
+  // a subset of it, equal keys mean equal remaining letters.
+  // Entry: b hash to subtract
+  //        key to append to
+  void PackDifference(const BasicOccupancyHash& b, std::string *key) const
+  {
+    for (size_t i = 0; i < index_ptr_; ++i) {
+      size_t index = (size_t) occupancy_index_[i];
+      CountT diff = char_count_[index] - b.char_count_[index];
+      for (size_t byte = 0; byte < sizeof(CountT); ++byte) {
+        key->push_back((char) (diff >> (byte * 8)));
+      }
+    }
+  }
+
+  // PackSubset
+  // Appends b in the encoding of PackDifference: one count per character of
+  // this hash.  For b a subset of this hash (the master), the key of b
+  // equals the PackDifference key of any remainder with the same letters.
+  // Entry: b hash to encode
+  //        key to append to
+  void PackSubset(const BasicOccupancyHash& b, std::string *key) const
+  {
+    for (size_t i = 0; i < index_ptr_; ++i) {
+      size_t index = (size_t) occupancy_index_[i];
+      CountT count = b.char_count_[index];
+      for (size_t byte = 0; byte < sizeof(CountT); ++byte) {
+        key->push_back((char) (count >> (byte * 8)));
+      }
+    }
+  }
+
+  // PackSignature
+  // Appends an encoding of the whole hash, lane by lane in lane order, to
+  // key.  Unlike the keys above it needs no master: words share a
+  // signature if and only if they are anagrams of one another.
+  // Entry: key to append to
+  void PackSignature(std::string *key) const
+  {
+    unsigned char lanes[kCapacity];
+    memcpy(lanes, occupancy_index_, index_ptr_);
+    std::sort(lanes, lanes + index_ptr_);
+    for (size_t i = 0; i < index_ptr_; ++i) {
+      CountT count = char_count_[lanes[i]];
+      key->push_back((char) lanes[i]);
+      for (size_t byte = 0; byte < sizeof(CountT); ++byte) {
+        key->push_back((char) (count >> (byte * 8)));
+      }
+    }
+  }
+
   // Compare
   // Returns a modified lexical comparison of two OccupancyHashes.
   // Entry: b hash to compare
@@ -111,7 +199,7 @@ class OccupancyHash
   //       0 == same count of same characters as b (complete anagram)
   //      -1 == has some of the characters in b, all less or equal count
   //      -2 == has all the characters in b but some fewer count
-  int Compare(const OccupancyHash& b)
+  int Compare(const BasicOccupancyHash& b)
   {
     int result = 0;
 
@@ -162,7 +250,7 @@ class OccupancyHash
   // Determines if the candidate is a complete subset of b
   // Entry: b to compare
   // Exit: true == is complete subset
-  bool IsSubset(const OccupancyHash& b)
+  bool IsSubset(const BasicOccupancyHash& b)
   {
     bool result = true; // assume success
     // Loop through the candidate and ensure that it contains
@@ -186,16 +274,25 @@ class OccupancyHash
   // GetCharCountMap
   // Count the # of unique characters in a string.
   // Entry: pointer to string
-  void GetCharCountMap(const char *word)
+  // Exit: false == string has a character outside the alphabet or more
+  //       unique characters than kCapacity; the hash is then incomplete
+  //       and should not be used.
+  bool GetCharCountMap(const char *word)
   {
     // This counts the characters, ignoring spaces.
     size_t char_index;
-    for (size_t i = 0; (char_index = (size_t) word[i]); ++i) {
-      if (0x20 == char_index)   // skip spaces
+    const char *p = word;
+    while (*p) {
+      char_index = Alphabet::Lane(p);
+      if (kSkipLane == char_index)   // skip spaces
         continue;
+      if (kForeignLane == char_index)
+        return false;
       // If this character is new to this occupancy matrix, add it
       // to the indexes and increase the # of unique characters.
       if (!char_count_[char_index]) {
+        if (index_ptr_ >= kCapacity)
+          return false;
         char_count_[char_index] = 1;
         index_index_[char_index] = index_ptr_;
         occupancy_index_[index_ptr_] = char_index;
@@ -204,15 +301,43 @@ class OccupancyHash
         char_count_[char_index]++;
       }
     }
+    return true;
   }
 
  private:
-  static const int kMaxCharsPerWord = 40;
-  char    occupancy_index_[kMaxCharsPerWord]; // indexes into char_count_
-  char    index_index_[256]; // maps char to occupancy_index_
-  char    char_count_[256]; // Size of domain (7/8 bit only)
+  unsigned char occupancy_index_[kCapacity]; // indexes into char_count_
+  unsigned char index_index_[Alphabet::kLanes]; // maps lane to occupancy_index_
+  CountT  char_count_[Alphabet::kLanes]; // count per alphabet lane
   size_t  index_ptr_;       // # of unique chars/occupancy_index_ tot
   static int constructor_count_;
 };
+
+template <class Alphabet, typename CountT, size_t kCapacity>
+int BasicOccupancyHash<Alphabet, CountT, kCapacity>::constructor_count_ = 0;
+
+// Limits within which the narrow OccupancyHash is safe.  The search sums two
+// candidate hashes before comparing against the master, so a master count
+// must fit in the counter twice over.
+const size_t kNarrowMaxUniqueChars = 40;
+const size_t kNarrowMaxCharCount = 127;
+
+// OccupancyHash
+// The narrow histogram: 8-bit counts and at most 40 unique characters.  This
+// covers words and short phrases and is the cheapest to clear and compare.
+template <class Alphabet>
+using OccupancyHash = BasicOccupancyHash<Alphabet, unsigned char,
+  (Alphabet::kLanes < kNarrowMaxUniqueChars ?
+    Alphabet::kLanes : kNarrowMaxUniqueChars)>;
+
+// WideOccupancyHash
+// The wide histogram: 16-bit counts and every lane of the alphabet, for
+// sentences and headlines that exceed the narrow limits.
+template <class Alphabet>
+using WideOccupancyHash =
+  BasicOccupancyHash<Alphabet, unsigned short, Alphabet::kLanes>;
+
+bool NeedsWideOccupancyHash(const char *phrase, AlphabetId alphabet);
+int ChooseHistogramEngine(const char *phrase, AlphabetId alphabet);
+
 } // namespace anagram
 #endif // #ifndef _OCCUPANCY_HASH_H_
@@ -24,6 +24,8 @@
 #ifndef _OUTPUT_QUEUE_H
 #define _OUTPUT_QUEUE_H
 
+#include <cstddef>
+
 #include "anagram_lock.h"
 
 namespace anagram {
@@ -52,8 +54,9 @@ class OutputQueue {
  public:
   OutputQueue();
   ~OutputQueue();
-  void Push(const char *);
+  void Push(const char *, size_t *pushed = nullptr);
   const char *Pop();
+  void Sync();
   void AcquireLock();
   void ReleaseLock();
  private:
@@ -0,0 +1,67 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _RESULT_SHARDS_H
+#define _RESULT_SHARDS_H
+
+#include <pthread.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace anagram {
+
+// ResultShards
+// This class collects the anagrams of a query without the search threads
+// contending for a shared list: each thread adds to its own shard.
+//
+// The threads then Merge together.  Each sorts its own shard; the key range
+// is split at keys sampled from the shards, and each thread does a k-way
+// merge of its range over all of the shards, dropping duplicates as it
+// goes.  The ranges are laid end to end, so the merged list is sorted and
+// unique.  Merge takes only what was added since the last Merge, so that
+// the passes of -f are each merged in turn.
+class ResultShards {
+ public:
+  ResultShards(size_t thread_tot);
+  ~ResultShards();
+  std::vector< std::string >& GetShard(size_t thread_index) {
+    return shards_[thread_index];
+  }
+  void Merge(
+    size_t thread_index,
+    pthread_barrier_t *barrier,
+    std::vector< std::string > *merged);
+ private:
+  void ChooseSplitters();
+  void FindRanges();
+  void MergeRange(size_t range);
+  size_t                                    thread_tot_;
+  std::vector< std::vector< std::string > > shards_;      // one per thread
+  std::vector< std::string >                splitters_;   // range bounds
+  std::vector< std::vector< size_t > >      range_starts_;  // [range][shard]
+  std::vector< std::vector< std::string > > parts_;       // merged ranges
+};
+} // namespace anagram
+
+#endif // #ifndef _RESULT_SHARDS_H
@@ -0,0 +1,119 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SEARCH_LIMITS_H
+#define _SEARCH_LIMITS_H
+
+#include <cstddef>
+#include <ctime>
+
+namespace anagram {
+
+// SearchLimits
+// Caller-set bounds on a query.  Zero means no limit.
+struct SearchLimits {
+  size_t min_words;         // words per anagram
+  size_t max_words;         // words per anagram
+  size_t min_word_length;   // letters per word
+  size_t max_word_length;   // letters per word
+  long time_limit_ms;       // wall clock, from the start of the query
+  long node_limit;          // combination steps, over all threads
+};
+
+// SearchBudget
+// This class tracks the time and node budget of a query for all of its
+// search threads and says when it has run out, at which point the search
+// unwinds and keeps whatever it has found.  Threads count nodes through
+// their own NodeMeter and report them in batches, so the clock and the
+// shared counter are only touched once per batch; the node limit may thus
+// be overrun by up to a batch per thread.  Stop() ends the search early and
+// is safe to call from a signal handler.  The time of the first result and
+// the heap allocations made by the search proper are kept for reporting.
+class SearchBudget {
+ public:
+  SearchBudget(const SearchLimits& limits);
+  ~SearchBudget();
+  bool Spend(long nodes);
+  void NoteResult();
+  void NoteAllocations(long allocations);
+  long GetElapsedMs() const;
+  long GetElapsedUs() const;
+  long GetFirstResultMs() const { return first_result_ms_; }
+  void Stop() { expired_ = true; }
+  bool Expired() const { return expired_; }
+  long GetNodes() const { return nodes_; }
+  long GetAllocations() const { return allocations_; }
+  const SearchLimits& GetLimits() const { return limits_; }
+ private:
+  SearchLimits      limits_;
+  struct timespec   start_;
+  volatile long     nodes_;
+  volatile long     first_result_ms_;   // -1 until there is a result
+  volatile long     allocations_;       // made while searching
+  volatile bool     expired_;
+};
+
+// NodeMeter
+// One search thread's view of a SearchBudget.  It has its own copy of the
+// limits so that a pass of the search may narrow the word range.
+class NodeMeter {
+ public:
+  NodeMeter(SearchBudget *budget) {
+    budget_ = budget;
+    limits_ = budget->GetLimits();
+    count_ = 0;
+  }
+  ~NodeMeter() { Flush(); }
+  // Visit
+  // Counts one node of the search.
+  // Exit: false == the budget is spent; the search should unwind
+  inline bool Visit() {
+    if (++count_ < kNodeBatch)
+      return !budget_->Expired();
+    return Flush();
+  }
+  // Flush
+  // Reports the nodes counted so far to the budget.
+  // Exit: false == the budget is spent
+  inline bool Flush() {
+    long count = count_;
+    count_ = 0;
+    return budget_->Spend(count);
+  }
+  bool Expired() const { return budget_->Expired(); }
+  const SearchLimits& GetLimits() const { return limits_; }
+  // SetWordRange
+  // Entry: fewest and most words per anagram (0 == no limit)
+  void SetWordRange(size_t min_words, size_t max_words) {
+    limits_.min_words = min_words;
+    limits_.max_words = max_words;
+  }
+ private:
+  static const long kNodeBatch = 1024;
+  SearchBudget *budget_;
+  SearchLimits limits_;
+  long count_;
+};
+} // namespace anagram
+
+#endif // #ifndef _SEARCH_LIMITS_H
@@ -0,0 +1,89 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SHARD_COORDINATOR_H
+#define _SHARD_COORDINATOR_H
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace anagram {
+
+// ShardCoordinator
+// This class runs one search as shards on separate worker processes
+// (--workers, --worker-cmd) and puts their results together.
+//
+// Shard i of n of a search (--shard=i/n) takes the first classes i, i + n,
+// i + 2n and so on, so the shards split the search without overlap.  Each
+// worker is a command, such as this program or an ssh to one on another
+// machine, that is run once per shard with the search's own arguments and
+// writes its results to a pipe.  A shard's results are spooled until its
+// worker exits cleanly; a shard that fails is handed out again.  The
+// shards are handed out as workers come free, so faster workers take more.
+class ShardCoordinator {
+ public:
+  ShardCoordinator(
+    const std::vector< std::string >& commands,
+    size_t shard_tot,
+    const std::vector< std::string >& options,
+    const std::vector< std::string >& phrase);
+  ~ShardCoordinator();
+  bool Run(
+    bool count_only,
+    bool output_directly,
+    std::vector< std::string > *lines,
+    size_t *count);
+ private:
+  struct Running {
+    pid_t pid;
+    int fd;             // read end of the worker's output
+    FILE *spool;        // the shard's output so far
+    size_t shard;
+    size_t worker;      // index of the command
+  };
+  bool Start(size_t worker, size_t shard);
+  bool Collect(
+    Running *running,
+    bool count_only,
+    bool output_directly,
+    std::vector< std::string > *lines,
+    size_t *count);
+  std::string GetCommand(size_t worker, size_t shard) const;
+
+  std::vector< std::string >  commands_;
+  size_t                      shard_tot_;
+  std::vector< std::string >  options_;   // less the coordinator's own
+  std::vector< std::string >  phrase_;
+  std::vector< Running >      running_;
+  std::deque< size_t >        pending_;   // shards not yet handed out
+  std::vector< size_t >       attempts_;  // by shard
+};
+
+std::string ShellQuote(const std::string& arg);
+} // namespace anagram
+
+#endif // #ifndef _SHARD_COORDINATOR_H
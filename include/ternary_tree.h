@@ -29,10 +29,15 @@
 #include <queue>
 #include <deque>
 #include <stack>
+#include <vector>
 #include "templ_node.h"
 
 typedef unsigned char UCHAR;
 
+// Shortest completion below a node that has none (see UpdateBest);
+// longer completions are clamped to one less
+const UCHAR kNoCompletion = 0xff;
+
 //#define DEBUG
 #define INFO
 
@@ -40,8 +45,9 @@ typedef unsigned char UCHAR;
 // This is the instantiable class from my TemplNode template
 class TNode : public TemplNode <UCHAR, TNode> {
  public:
-  TNode() {};
-  TNode(UCHAR key) : TemplNode <UCHAR, TNode> (key) { };
+  TNode() : weight_(0), best_(0), shortest_(kNoCompletion) {};
+  TNode(UCHAR key) : TemplNode <UCHAR, TNode> (key),
+    weight_(0), best_(0), shortest_(kNoCompletion) { };
   ~TNode() {};
   void SetKey(UCHAR key)
   {
@@ -51,6 +57,22 @@ class TNode : public TemplNode <UCHAR, TNode> {
     }
     key_ = (UCHAR) tolower(key);
   }
+  // Weight of the word ending at this node (see Insert)
+  unsigned GetWeight() { return weight_; }
+  void SetWeight(unsigned weight) { weight_ = weight; }
+  // Highest weight of the words in this node's subtree, and the length of
+  // the shortest of those, counted from this node's own position
+  unsigned GetBest() { return best_; }
+  UCHAR GetShortest() { return shortest_; }
+  void SetBest(unsigned best, UCHAR shortest)
+  {
+    best_ = best;
+    shortest_ = shortest;
+  }
+ protected:
+  unsigned weight_;
+  unsigned best_;
+  UCHAR shortest_;
 };
 
 // TernaryTree
@@ -63,7 +85,8 @@ class TernaryTree {
   ~TernaryTree();
   void SetRoot(TNode **root);
   TNode *GetRoot();
-  TNode * Insert(const char *pWord, TNode **ppNode = NULL);
+  TNode * Insert(const char *pWord, TNode **ppNode = NULL,
+    unsigned weight = 0);
   bool Find(const char *pWord, TNode *pParent, TNode ** ppTerminal = NULL);
   void FuzzyFind(
     const char *pWord,
@@ -86,6 +109,17 @@ class TernaryTree {
     std::map< int, int > *tie_breaker_lookup,
     const int max_diff = 0,
     int depth = 0);
+  void PatternFind(
+    const char *pattern,
+    TNode *pParent,
+    const char *rack,
+    std::vector< std::string > *words);
+  void UpdateBest(TNode *node);
+  void Complete(
+    const char *prefix,
+    TNode *pParent,
+    size_t k,
+    std::vector< std::string > *words);
 
  int GetMaxTies() { return tie_hwm_; }
  void ClearMaxTies() { tie_hwm_ = 0; }
@@ -96,6 +130,27 @@ class TernaryTree {
   void DeleteNode(TNode *node);
   void DeleteTree(TNode *node);
   int CalcLevenshtein(const char *s1, const char *s2);
+  void MatchPattern(
+    TNode *node,
+    const char *pattern,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words);
+  void MatchLevel(
+    TNode *node,
+    const char *rest,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words);
+  void TakeNode(
+    TNode *node,
+    const char *rest,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words);
 
   // member variables
   int tie_hwm_;
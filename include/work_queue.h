@@ -0,0 +1,78 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+
+#include "anagram_lock.h"
+
+namespace anagram {
+
+// SearchTask
+// One unit of combination work: the whole branch below a first word, or,
+// once a first-word branch has been split, the branch below a two-word
+// prefix.  Words are indexes into the partial list.
+struct SearchTask {
+  int first;    // index of the first word
+  int second;   // index of the second word, or -1 for the whole branch
+};
+
+// WorkStealingQueue
+// This class schedules SearchTasks over a fixed set of worker threads.  Each
+// thread owns a deque; it pushes and pops its own work at the back (LIFO,
+// so it stays on the branch it is in) and, when that runs dry, steals from
+// the front of another thread's deque (FIFO, so it takes the oldest and
+// typically largest branch).  Work is considered finished only when every
+// pushed task has been marked Done, so a thread that is still running a task
+// that may split further keeps the others polling instead of exiting.  A
+// thread that has tasks still to push, but none yet, holds the work open
+// the same way (see Hold).
+class WorkStealingQueue {
+ public:
+  WorkStealingQueue(size_t thread_tot);
+  ~WorkStealingQueue();
+  void Push(size_t thread_index, const SearchTask& task);
+  bool Pop(size_t thread_index, SearchTask *task);
+  void Done();
+  void Hold();
+  bool Finished() { return !pending_; }
+  bool Hungry() { return 0 != idle_; }
+  size_t GetThreadTot() { return thread_tot_; }
+ private:
+  struct TaskDeque {
+    Lock lock;
+    std::deque< SearchTask > tasks;
+    bool idle;
+  };
+  bool Steal(size_t thread_index, SearchTask *task);
+  TaskDeque *   deques_;      // one per thread
+  size_t        thread_tot_;
+  volatile long pending_;     // tasks pushed but not yet Done
+  volatile long idle_;        // threads that found no work on last Pop
+};
+} // namespace anagram
+
+#endif // #ifndef _WORK_QUEUE_H
@@ -0,0 +1,108 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+
+#include "alphabet.h"
+
+namespace anagram {
+
+uint16_t Utf8Alphabet::table_[Utf8Alphabet::kTableSize];
+size_t Utf8Alphabet::lane_tot_ = 0;
+
+// Code points outside the Basic Multilingual Plane are rare enough that a
+// map is adequate for them.
+static std::map< uint32_t, uint16_t > extended_lanes;
+
+// Register
+// Assigns lanes to any letters of a word not yet seen.  ASCII letters are
+// folded to lower case, matching the trie.
+// Entry: word
+void Utf8Alphabet::Register(const char *word)
+{
+  const char *p = word;
+  while (*p) {
+    uint32_t cp = Decode(p);
+    if (' ' == cp)
+      continue;
+    if (cp >= 'A' && cp <= 'Z')
+      cp += 'a' - 'A';
+    uint16_t *entry = cp < kTableSize ? &table_[cp] : &extended_lanes[cp];
+    if (!*entry && lane_tot_ < kLanes) {
+      *entry = (uint16_t) ++lane_tot_;  // lane + 1
+      if (cp >= 'a' && cp <= 'z')
+        table_[cp - 'a' + 'A'] = *entry;
+    }
+  }
+}
+
+// LookupExtended
+// Lane lookup for code points beyond the BMP table.
+// Entry: code point
+// Exit: lane or kForeignLane
+size_t Utf8Alphabet::LookupExtended(uint32_t cp)
+{
+  auto it = extended_lanes.find(cp);
+  return extended_lanes.end() == it ? kForeignLane : ToLane(it->second);
+}
+
+// IsValidUtf8
+// Entry: null-terminated string
+// Exit: true == well-formed UTF-8
+static bool IsValidUtf8(const char *s)
+{
+  const unsigned char *p = (const unsigned char *) s;
+  while (*p) {
+    size_t extra = *p < 0x80 ? 0 :
+      (*p & 0xe0) == 0xc0 ? 1 :
+      (*p & 0xf0) == 0xe0 ? 2 :
+      (*p & 0xf8) == 0xf0 ? 3 : 4;
+    if (extra > 3)
+      return false;
+    ++p;
+    while (extra--) {
+      if ((*p & 0xc0) != 0x80)
+        return false;
+      ++p;
+    }
+  }
+  return true;
+}
+
+// ChooseAlphabet
+// English if the phrase is plain a-z, the dictionary remap if it is other
+// well-formed UTF-8, and raw Latin-1 bytes otherwise.
+// Entry: phrase
+// Exit: alphabet id
+AlphabetId ChooseAlphabet(const char *phrase)
+{
+  bool english = true;
+  for (const char *p = phrase; *p && english; ) {
+    english = kForeignLane != EnglishAlphabet::Lane(p);
+  }
+  if (english)
+    return ALPHABET_ENGLISH;
+  return IsValidUtf8(phrase) ? ALPHABET_UTF8 : ALPHABET_LATIN1;
+}
+
+} // namespace anagram
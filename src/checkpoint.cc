@@ -0,0 +1,278 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "checkpoint.h"
+
+namespace anagram {
+
+const char *kCheckpointHeader = "anagram-checkpoint 2";
+const long kCheckpointIntervalMs = 60000;
+
+// NowMs
+// Exit: milliseconds on the monotonic clock
+static long NowMs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Constructor
+// Entry: path of the checkpoint file
+Checkpoint::Checkpoint(const std::string& path)
+{
+  path_ = path;
+  thread_tot_ = 1;
+  output_length_ = 0;
+  resumed_ = false;
+  last_save_ms_ = NowMs();
+}
+
+// Destructor
+Checkpoint::~Checkpoint()
+{
+}
+
+// Load
+// Reads a saved checkpoint to resume from.  Each task that was under way
+// passes over the results it had already written since the second class it
+// picks up at.
+// Entry: arguments to fill in with those the search was started with
+// Exit: true == loaded
+bool Checkpoint::Load(std::vector< std::string > *args)
+{
+  std::ifstream in(path_);
+  std::string line;
+  if (!std::getline(in, line) || line != kCheckpointHeader)
+    return false;
+  size_t arg_tot = 0, task_tot = 0;
+  if (!std::getline(in, line))
+    return false;
+  std::istringstream counts(line);
+  if (!(counts >> thread_tot_ >> output_length_ >> arg_tot >> task_tot) ||
+      !thread_tot_ || output_length_ < 0)
+    return false;
+
+  args_.clear();
+  for (size_t i = 0; i < arg_tot; ++i) {
+    if (!std::getline(in, line))
+      return false;
+    args_.push_back(line);
+  }
+
+  tasks_.clear();
+  for (size_t i = 0; i < task_tot; ++i) {
+    if (!std::getline(in, line))
+      return false;
+    std::istringstream fields(line);
+    int first, second, done;
+    size_t split_tot;
+    CheckpointTask task = CheckpointTask();
+    if (!(fields >> first >> second >> done >> task.emitted >>
+          task.resume_at >> task.resume_emitted >> split_tot) ||
+        task.resume_emitted > task.emitted)
+      return false;
+    task.done = 0 != done;
+    task.skip = task.emitted - task.resume_emitted;
+    task.split.resize(split_tot);
+    for (size_t j = 0; j < split_tot; ++j) {
+      if (!(fields >> task.split[j]))
+        return false;
+    }
+    tasks_[TaskKey(first, second)] = task;
+  }
+
+  *args = args_;
+  resumed_ = true;
+  return true;
+}
+
+// SetQuery
+// Entry: arguments of the search, to start it again with on resume
+//        # of search threads
+void Checkpoint::SetQuery(
+  const std::vector< std::string >& args,
+  size_t thread_tot)
+{
+  args_ = args;
+  thread_tot_ = thread_tot;
+}
+
+// QueueTasks
+// Queues every task with a first class in the range that is not yet done:
+// the first-class tasks, and the tasks handed off by them, dealt
+// round-robin.
+// Entry: first of the first classes
+//        end of the first classes
+//        work queue
+void Checkpoint::QueueTasks(
+  size_t first,
+  size_t end,
+  WorkStealingQueue *work_queue)
+{
+  size_t queued = 0;
+  lock_.Acquire();
+  for (size_t i = first; i < end; ++i) {
+    auto found = tasks_.find(TaskKey((int) i, -1));
+    if (tasks_.end() != found && found->second.done)
+      continue;
+    SearchTask task = { (int) i, -1 };
+    work_queue->Push(queued++ % work_queue->GetThreadTot(), task);
+  }
+  for (const auto& i : tasks_) {
+    if (i.first.first < (int) first || i.first.first >= (int) end ||
+        i.first.second < 0 || i.second.done)
+      continue;
+    SearchTask task = { i.first.first, i.first.second };
+    work_queue->Push(queued++ % work_queue->GetThreadTot(), task);
+  }
+  lock_.Release();
+}
+
+// Begin
+// Entry: task about to be run
+// Exit: its progress, from an earlier run if there was one
+CheckpointTask *Checkpoint::Begin(const SearchTask& task)
+{
+  lock_.Acquire();
+  CheckpointTask *state = &tasks_[TaskKey(task.first, task.second)];
+  lock_.Release();
+  return state;
+}
+
+// Split
+// Records a task handed off by another.
+// Entry: progress of the task handing it off
+//        task handed off
+void Checkpoint::Split(CheckpointTask *parent, const SearchTask& task)
+{
+  lock_.Acquire();
+  parent->split.push_back(task.second);
+  tasks_[TaskKey(task.first, task.second)];
+  lock_.Release();
+}
+
+// Progress
+// Records that a task has finished every second class before the one it is
+// to pick up at if resumed.  Only the thread running the task calls this,
+// and so the results it has written, less those it has yet to pass over,
+// are the ones before that class.
+// Entry: progress of the task
+//        second class to pick up at
+void Checkpoint::Progress(CheckpointTask *task, int resume_at)
+{
+  lock_.Acquire();
+  task->resume_at = resume_at;
+  task->resume_emitted = task->emitted - task->skip;
+  lock_.Release();
+}
+
+// Finish
+// Entry: progress of a task that has run to the end
+void Checkpoint::Finish(CheckpointTask *task)
+{
+  lock_.Acquire();
+  task->done = true;
+  lock_.Release();
+}
+
+// SaveIfDue
+// Saves, if the last save was long enough ago and no other thread is
+// saving.
+// Entry: output queue
+void Checkpoint::SaveIfDue(OutputQueue *queue)
+{
+  if (NowMs() - last_save_ms_ < kCheckpointIntervalMs)
+    return;
+  save_lock_.Acquire();
+  if (NowMs() - last_save_ms_ >= kCheckpointIntervalMs) {
+    Save(queue);
+  }
+  save_lock_.Release();
+}
+
+// Save
+// Writes the checkpoint, after getting everything queued so far into the
+// output.
+// Entry: output queue
+// Exit: true == saved
+bool Checkpoint::Save(OutputQueue *queue)
+{
+  std::ostringstream out;
+  lock_.Acquire();
+  queue->AcquireLock();
+  queue->Sync();
+  long length = (long) lseek(STDOUT_FILENO, 0, SEEK_END);
+  out << kCheckpointHeader << "\n" << thread_tot_ << " " << length << " "
+    << args_.size() << " " << tasks_.size() << "\n";
+  for (const auto& arg : args_) {
+    out << arg << "\n";
+  }
+  for (const auto& i : tasks_) {
+    // Nothing more is needed of a task that is done
+    const CheckpointTask& task = i.second;
+    out << i.first.first << " " << i.first.second << " " << task.done;
+    if (task.done) {
+      out << " 0 0 0 0\n";
+      continue;
+    }
+    out << " " << task.emitted << " " << task.resume_at << " "
+      << task.resume_emitted << " " << task.split.size();
+    for (int second : task.split) {
+      out << " " << second;
+    }
+    out << "\n";
+  }
+  queue->ReleaseLock();
+  lock_.Release();
+  last_save_ms_ = NowMs();
+  if (length < 0)
+    return false;
+
+  std::string temp_path = path_ + ".tmp";
+  {
+    std::ofstream file(temp_path);
+    file << out.str();
+    file.flush();
+    if (!file)
+      return false;
+  }
+  if (rename(temp_path.c_str(), path_.c_str()))
+    return false;
+  output_length_ = length;
+  return true;
+}
+
+// Remove
+// Deletes the checkpoint once the search has run to the end.
+void Checkpoint::Remove()
+{
+  unlink(path_.c_str());
+}
+} // namespace anagram
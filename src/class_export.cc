@@ -0,0 +1,189 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sched.h>
+#include <algorithm>
+#include <functional>
+
+#include "alphabet.h"
+#include "anagram_log.h"
+#include "class_export.h"
+#include "occupancy_hash.h"
+
+namespace anagram {
+
+// Constructor
+// Entry: dictionary index (its words; it need not be built)
+//        # of threads
+ClassExport::ClassExport(
+  const DictionaryIndex& dictionary_index,
+  size_t thread_tot
+) : dictionary_index_(dictionary_index),
+    thread_tot_(thread_tot ? thread_tot : 1),
+    shards_(thread_tot ? thread_tot : 1),
+    classes_(nullptr),
+    skipped_(0),
+    go_(false),
+    aborted_(false)
+{
+  dealt_.resize(thread_tot_,
+    std::vector< std::vector< SignedWord > >(thread_tot_));
+}
+
+// Destructor
+ClassExport::~ClassExport()
+{
+}
+
+// Run
+// Finds the classes, each listed as its words in alphabetical order on one
+// line, separated by spaces; the lines are in alphabetical order too.
+// The threads wait to be let go until all of them have been created; if
+// one cannot be, those that were are let go to exit instead, before they
+// reach a barrier.
+// Entry: list to fill in
+// Exit: false == the threads could not be started
+bool ClassExport::Run(std::vector< std::string > *classes)
+{
+  classes->clear();
+  classes_ = classes;
+  skipped_ = 0;
+  go_ = aborted_ = false;
+  pthread_barrier_init(&barrier_, nullptr, thread_tot_);
+  std::vector< pthread_t > threads(thread_tot_);
+  std::vector< WorkerParams > params(thread_tot_);
+  size_t created = 0;
+  for (; created < thread_tot_; ++created) {
+    params[created].owner = this;
+    params[created].thread_index = created;
+    if (pthread_create(&threads[created], nullptr, &Worker,
+          &params[created])) {
+      VERBOSE_LOG(LOG_NONE, "Thread creation error" << std::endl);
+      aborted_ = true;
+      break;
+    }
+  }
+  go_ = true;
+  for (size_t i = 0; i < created; ++i) {
+    pthread_join(threads[i], nullptr);
+  }
+  pthread_barrier_destroy(&barrier_);
+  return !aborted_;
+}
+
+// Worker
+// Entry: WorkerParams
+// Exit: (ignored)
+void *ClassExport::Worker(void *worker_params)
+{
+  auto *params = (WorkerParams *) worker_params;
+  ClassExport *owner = params->owner;
+  while (!owner->go_) {
+    sched_yield();
+  }
+  if (owner->aborted_) {
+    return nullptr;
+  }
+  owner->Sign(params->thread_index);
+  pthread_barrier_wait(&owner->barrier_);
+  owner->Group(params->thread_index);
+  owner->shards_.Merge(params->thread_index, &owner->barrier_,
+    owner->classes_);
+  return nullptr;
+}
+
+// Sign
+// Signs the calling thread's part of the dictionary and deals the words
+// out to the threads that will group them.  Phrases are left out, as are
+// words too long for the histogram.
+// Entry: index of the calling thread
+void ClassExport::Sign(size_t thread_index)
+{
+  size_t word_tot = dictionary_index_.GetWordCount();
+  size_t first = word_tot * thread_index / thread_tot_;
+  size_t last = word_tot * (thread_index + 1) / thread_tot_;
+  std::vector< std::vector< SignedWord > >& mine = dealt_[thread_index];
+  for (auto& to : mine) {
+    to.reserve((last - first) / thread_tot_ + 1);
+  }
+  OccupancyHash< Utf8Alphabet > count;
+  std::hash< std::string > hash;
+  std::string signature;
+  long skipped = 0;
+  for (size_t id = first; id < last; ++id) {
+    const std::string& word = dictionary_index_.GetWord(id);
+    count.clear();
+    if (std::string::npos != word.find(' ') ||
+        !count.GetCharCountMap(word.c_str()) ||
+        count.GetMaxCharCount() > kNarrowMaxCharCount) {
+      ++skipped;
+      continue;
+    }
+    signature.clear();
+    count.PackSignature(&signature);
+    mine[hash(signature) % thread_tot_].push_back(
+      SignedWord(signature, id));
+  }
+  __sync_add_and_fetch(&skipped_, skipped);
+}
+
+// Group
+// Sorts the words dealt to the calling thread by signature, then word,
+// and adds each run of two or more with the same signature to the
+// thread's shard as a class.
+// Entry: index of the calling thread
+void ClassExport::Group(size_t thread_index)
+{
+  std::vector< std::pair< const std::string *, const std::string * > >
+    words;   // signature, word
+  for (auto& from : dealt_) {
+    for (const auto& i : from[thread_index]) {
+      words.push_back(std::make_pair(&i.first,
+        &dictionary_index_.GetWord(i.second)));
+    }
+  }
+  std::sort(words.begin(), words.end(),
+    [](const std::pair< const std::string *, const std::string * >& a,
+       const std::pair< const std::string *, const std::string * >& b) {
+      int order = a.first->compare(*b.first);
+      return order ? order < 0 : *a.second < *b.second;
+    });
+
+  std::vector< std::string >& shard = shards_.GetShard(thread_index);
+  size_t start = 0;
+  while (start < words.size()) {
+    size_t end = start + 1;
+    while (end < words.size() && *words[end].first == *words[start].first)
+      ++end;
+    if (end - start > 1) {
+      std::string line = *words[start].second;
+      for (size_t i = start + 1; i < end; ++i) {
+        line += ' ';
+        line += *words[i].second;
+      }
+      shard.push_back(line);
+    }
+    start = end;
+  }
+}
+} // namespace anagram
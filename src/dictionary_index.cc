@@ -0,0 +1,121 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cctype>
+
+#include "dictionary_index.h"
+
+namespace anagram {
+
+// Constructor
+DictionaryIndex::DictionaryIndex()
+{
+  block_tot_ = 0;
+  slice_tot_ = 0;
+}
+
+// Add
+// Adds a word to be indexed by the next Build, unless it already was.
+// Entry: word
+// Exit: true == the word is new
+bool DictionaryIndex::Add(const char *word)
+{
+  if (!ids_.emplace(word, words_.size()).second)
+    return false;
+  words_.push_back(word);
+  return true;
+}
+
+// GetWordSet
+// Entry: words, in any case; those not in the dictionary are ignored
+//        bitset to fill in
+void DictionaryIndex::GetWordSet(
+  const std::vector< std::string >& words,
+  std::vector< uint64_t > *word_set
+) const
+{
+  word_set->assign(block_tot_, 0);
+  std::string lower;
+  for (const auto& word : words) {
+    lower = word;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    auto found = ids_.find(lower);
+    if (ids_.end() != found)
+      (*word_set)[found->second >> 6] |= (uint64_t) 1 << (found->second & 63);
+  }
+}
+
+// Reset
+// Clears the bitsets.
+// Entry: # of lanes of the alphabet to index for
+void DictionaryIndex::Reset(size_t lane_tot)
+{
+  block_tot_ = (words_.size() + 63) >> 6;
+  slice_tot_ = 0;
+  unusable_.assign(block_tot_, 0);
+  slices_.assign(lane_tot, std::vector< size_t >());
+  bits_.clear();
+}
+
+// AddSlice
+// Adds the lane's next slice, all clear.
+// Entry: lane
+void DictionaryIndex::AddSlice(size_t lane)
+{
+  slices_[lane].push_back(bits_.size());
+  bits_.resize(bits_.size() + block_tot_, 0);
+  ++slice_tot_;
+}
+
+// AndNot
+// Clears in a the bits set in b.  The loop is plain enough for the compiler
+// to turn into vector instructions.
+// Entry: bitset to update
+//        bitset of bits to clear
+//        # of 64-bit blocks in each
+void DictionaryIndex::AndNot(uint64_t *a, const uint64_t *b, size_t block_tot)
+{
+  for (size_t i = 0; i < block_tot; ++i) {
+    a[i] &= ~b[i];
+  }
+}
+
+// CollectIds
+// Entry: bitset over a run of the words
+//        first block of the run
+//        list to append the ids set in the bitset to, ascending
+void DictionaryIndex::CollectIds(
+  const std::vector< uint64_t >& fit,
+  size_t first,
+  std::vector< size_t > *ids) const
+{
+  for (size_t block = 0; block < fit.size(); ++block) {
+    for (uint64_t bits = fit[block]; bits; bits &= bits - 1) {
+      size_t id = ((first + block) << 6) + __builtin_ctzll(bits);
+      if (id < words_.size())
+        ids->push_back(id);
+    }
+  }
+}
+} // namespace anagram
@@ -26,6 +26,7 @@
 #include <cstdio>
 #include <memory.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <csignal>
 #include <pthread.h>
 #include <ctime>
@@ -35,15 +36,30 @@
 #include <map>
 #include <algorithm>
 #include <thread>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <memory>
 
 #include "anagram_common.h"
 #include "anagram_flags.h"
 #include "templ_node.h"
 #include "ternary_tree.h"
 #include "anagram_log.h"
+#include "alphabet.h"
 #include "occupancy_hash.h"
+#include "dense_occupancy_hash.h"
 #include "anagram_lock.h"
 #include "output_queue.h"
+#include "work_queue.h"
+#include "memo_table.h"
+#include "search_limits.h"
+#include "dictionary_index.h"
+#include "alloc_counter.h"
+#include "result_shards.h"
+#include "checkpoint.h"
+#include "class_export.h"
+#include "shard_coordinator.h"
 
 namespace anagram {
 // CleanString
@@ -57,75 +73,56 @@ std::string& CleanString(std::string& s) {
     return s;
 }
 
-// GetWordCount
-// Count the number of words in a file.  Assume one word per line.
-// Entry: ifstream
-// Exit: # of words in files
-int GetWordCount(std::ifstream *file)
+// SplitWeight
+// Takes the weight off a dictionary line.  A word may be followed by a tab
+// and a weight, such as how often it is used, which ranks the completions
+// of -c (see TernaryTree::Complete); the search itself ignores it.
+// Entry: line (in/out: the word alone)
+// Exit: weight; 0 == none given
+unsigned SplitWeight(std::string *line)
 {
-  int lineTot;
-  lineTot = std::count(std::istreambuf_iterator<char>(*file),
-                       std::istreambuf_iterator<char>(), '\n');
-  file->seekg(0);
-  return lineTot;
+  size_t tab = line->find('\t');
+  if (std::string::npos == tab)
+    return 0;
+  unsigned weight = (unsigned) strtoul(line->c_str() + tab + 1, nullptr, 10);
+  line->resize(tab);
+  return weight;
 }
 
 // ReadDictionaryFile
-// Read dictionary file into our trie data structure.
-// TODO (RFE): Would be nice to have the tree self-balance
-// instead of reading the sorted file in two halves...
+// Reads a dictionary file into the dictionary index, which is all the
+// search needs.  The lines are kept only for the lookups that use the trie
+// (see BuildTrie).  A line is a word, optionally followed by a weight (see
+// SplitWeight).
 // Entry: path to file
-//        pointer to TernaryTree
-//        pointer to tree root node
+//        lines read, as they are in the file (nullptr == not kept)
+//        dictionary index to add the new words to (lowercased)
 void ReadDictionaryFile(
   const char *path,
-  TernaryTree *trie,
-  TNode *& root_node
+  std::vector< std::string > *lines,
+  DictionaryIndex *dictionary_index
 )
 {
   try
   {
     std::ifstream file(path);
     std::string line;
-    int lineTot = GetWordCount(&file);
-    int start = lineTot >> 1;
-    int idx = 0;
-
-    VERBOSE_LOG(LOG_INFO, "Reading " << lineTot << " words." << std::endl);
-
-    // Skip to middle of file
-    while (idx < start) {
-      getline(file, line);
-      idx++;
-    }
-
-    // Insert second half
-    VERBOSE_LOG(LOG_INFO, "Reading phase 1..." << std::endl);
     std::locale loc;
     std::string lowerline;
-    while (getline(file, line) )
+    size_t line_tot = 0;
+    while (getline(file, line))
     {
+      if (lines)
+        lines->push_back(line);
+      SplitWeight(&line);
       lowerline = "";
-      //VERBOSE_LOG(LOG_DEBUG, "|" << line.c_str() << "|" << std::endl);
       for(auto elem : line)    // convert to lowercase; trie stores thus
          lowerline += std::tolower(elem,loc);
-      if (!trie->Find(lowerline.c_str(), root_node)) {
-        trie->Insert(line.c_str(), &root_node);
-      }
-    }
-
-    // Insert first half
-    VERBOSE_LOG(LOG_INFO, "Reading phase 2..." << std::endl);
-    idx = 0;
-    file.clear();
-    file.seekg(0, std::ios::beg);
-    while (idx < start)
-    {
-      getline(file, line);
-      VERBOSE_LOG(LOG_DEBUG, "|" << line.c_str() << "|" << std::endl);
-      trie->Insert(line.c_str(), &root_node);
-      idx++;
+      if (dictionary_index->Add(lowerline.c_str()))
+        Utf8Alphabet::Register(lowerline.c_str());
+      ++line_tot;
     }
+    VERBOSE_LOG(LOG_INFO, "Read " << line_tot << " words." << std::endl);
   }
   catch(...)
   {
@@ -133,6 +130,175 @@ void ReadDictionaryFile(
   }
 }
 
+// BuildTrie
+// Reads the dictionary lines into our trie data structure, for the
+// lookups that walk it (-p, -c); the anagram search works from the
+// dictionary index alone.
+// TODO (RFE): Would be nice to have the tree self-balance
+// instead of reading the sorted file in two halves...
+// Entry: trie
+//        root node of the trie
+//        lines of each dictionary file, with any weights
+void BuildTrie(
+  TernaryTree *trie,
+  TNode **root_node,
+  const std::vector< std::vector< std::string > >& files
+)
+{
+  std::string word;
+  for (const auto& lines : files) {
+    size_t start = lines.size() >> 1;
+
+    // Insert second half, then first half
+    for (size_t j = 0; j < lines.size(); ++j) {
+      size_t i = (start + j) % lines.size();
+      word = lines[i];
+      unsigned weight = SplitWeight(&word);
+      trie->Insert(word.c_str(), root_node, weight);
+    }
+  }
+  trie->UpdateBest(*root_node);   // for Complete
+}
+
+// SubtractWords
+// Takes the letters of the words to include (-i) out of the phrase.
+// Entry: phrase
+//        words to include
+//        phrase left to search
+// Exit: true == the phrase had the letters of all the words
+template <class Alphabet>
+bool SubtractWords(
+  const std::string& phrase,
+  const std::vector< std::string >& words,
+  std::string *rest
+)
+{
+  std::string left;
+  *rest = phrase;
+  for (const auto& w : words) {
+    if (!SubtractLetters< Alphabet >(rest->c_str(), w.c_str(), &left))
+      return false;
+    rest->swap(left);
+  }
+  return true;
+}
+
+// Tile values of the usual word game, a to z; other letters score 1
+static const int kTileScores[26] = {
+  1, 3, 3, 2, 1, 4, 2, 4, 1, 8, 5, 1, 3, 1, 1, 3, 10, 1, 1, 1, 1, 4, 4, 8, 4,
+  10
+};
+
+// SubWord
+// A word formable from the letters of a rack (-a), and what it ranks by.
+struct SubWord {
+  size_t id;            // in the dictionary index
+  size_t length;        // # of letters
+  int score;            // tile values; letters from blanks score nothing
+  std::string blanks;   // the letters the blanks stand for
+};
+
+// DescribeSubWord
+// Works out which letters of a word come from the rack and which from
+// blanks.  Which occurrences of a letter are taken as blanks makes no
+// difference to the score.
+// Entry: word
+//        letter counts of the rack, by lane
+//        sub-word to fill in
+template <class Alphabet>
+void DescribeSubWord(
+  const std::string& word,
+  std::vector< size_t > rack_counts,
+  SubWord *sub_word
+)
+{
+  sub_word->length = 0;
+  sub_word->score = 0;
+  sub_word->blanks.clear();
+  const char *p = word.c_str();
+  while (*p) {
+    const char *start = p;
+    size_t lane = Alphabet::Lane(p);
+    if (kSkipLane == lane)
+      continue;
+    ++sub_word->length;
+    if (lane < rack_counts.size() && rack_counts[lane]) {
+      --rack_counts[lane];
+      unsigned char c = (unsigned char) tolower(*start);
+      sub_word->score += c >= 'a' && c <= 'z' ? kTileScores[c - 'a'] : 1;
+    } else {
+      sub_word->blanks.append(start, p - start);
+    }
+  }
+}
+
+// ListSubWords
+// Lists every dictionary word formable from a rack of letters and blanks
+// (-a), longest first, or highest scoring first with -as; ties are in
+// alphabetical order.  Each line is the word, then its score with -as,
+// then the letters its blanks stand for, if any, in brackets.
+// Entry: dictionary index
+//        letters of the rack
+//        # of blanks
+//        words to leave out
+//        search limits (word lengths)
+//        flags
+//        list to fill in
+template <class Alphabet>
+void ListSubWords(
+  const DictionaryIndex& dictionary_index,
+  const char *rack,
+  size_t blank_tot,
+  const std::vector< uint64_t >& excluded,
+  const SearchLimits& limits,
+  AnagramFlags flags,
+  std::vector< std::string > *lines
+)
+{
+  std::vector< size_t > fitting;
+  dictionary_index.FindFittingWithBlanks< Alphabet >(rack, blank_tot,
+    excluded, &fitting);
+  std::vector< size_t > rack_counts(Alphabet::LaneCount(), 0);
+  for (const char *p = rack; *p; ) {
+    size_t lane = Alphabet::Lane(p);
+    if (lane < rack_counts.size())
+      ++rack_counts[lane];
+  }
+
+  std::vector< SubWord > sub_words;
+  for (size_t id : fitting) {
+    SubWord sub_word;
+    sub_word.id = id;
+    DescribeSubWord< Alphabet >(dictionary_index.GetWord(id), rack_counts,
+      &sub_word);
+    if (sub_word.length < limits.min_word_length ||
+        (limits.max_word_length && sub_word.length > limits.max_word_length))
+      continue;
+    sub_words.push_back(sub_word);
+  }
+  bool by_score = flags.rank_by_score;
+  std::sort(sub_words.begin(), sub_words.end(),
+    [&](const SubWord& a, const SubWord& b) {
+      if (by_score && a.score != b.score)
+        return a.score > b.score;
+      if (a.length != b.length)
+        return a.length > b.length;
+      return dictionary_index.GetWord(a.id) < dictionary_index.GetWord(b.id);
+    });
+
+  lines->clear();
+  for (const auto& sub_word : sub_words) {
+    std::string line = dictionary_index.GetWord(sub_word.id);
+    if (by_score) {
+      line += " " + std::to_string(sub_word.score);
+    }
+    if (!sub_word.blanks.empty()) {
+      line += " [" + sub_word.blanks + "]";
+    }
+    lines->push_back(line);
+  }
+}
+
 // OutputPreamble
 void OutputPreamble()
 {
@@ -167,31 +333,83 @@ void PrintUsage()
   cout << "Example:" << endl;
   cout << "\nanagram hello world" << endl << endl;
   cout << "Flags:" << endl;
+  cout << "\t--count print only the # of anagrams; counts words that are" << endl;
+  cout << "\t\tanagrams of one another together instead of listing them" << endl;
+  cout << "\t--classes=file write every set of dictionary words that are" << endl;
+  cout << "\t\tanagrams of one another to the file, a set per line (no" << endl;
+  cout << "\t\tphrase; add -b for the big dictionary)" << endl;
+  cout << "\t--checkpoint=file with -o to a file, save progress every minute" << endl;
+  cout << "\t\tand when stopped, so the search can be resumed" << endl;
+  cout << "\t--shard=i/n search only shard i (0..n-1) of n, for a worker" << endl;
+  cout << "\t--shards=n # of shards to split the search into for workers" << endl;
+  cout << "\t\t(default 4 per worker)" << endl;
+  cout << "\t--workers=n run the search as shards on n worker processes" << endl;
+  cout << "\t\t(not with -T or -N, which would apply to each shard)" << endl;
+  cout << "\t--worker-cmd=command add a worker that runs the command, such" << endl;
+  cout << "\t\tas one on another machine (example --worker-cmd=\"ssh box" << endl;
+  cout << "\t\tcd anagram/bin \\&\\& ./anagram\"); the search's arguments" << endl;
+  cout << "\t\tfollow it" << endl;
+  cout << "\t--resume=file carry on from a checkpoint with the search's own" << endl;
+  cout << "\t\targuments, appending to its output (example" << endl;
+  cout << "\t\tanagram --resume=cp >> out.txt)" << endl;
+  cout << "\t-a all dictionary words formable from the letters, longest" << endl;
+  cout << "\t\tfirst; -as ranks them by tile score instead.  Each ? in" << endl;
+  cout << "\t\tthe letters is a blank for any letter (example -a 'ret?ai?')" << endl;
   cout << "\t-b Use big dictionary (~423,000 words)" << endl;
+  cout << "\t-c complete: the best words starting with the letters, by" << endl;
+  cout << "\t\tthe weight after a tab on a dictionary line (none == 0)," << endl;
+  cout << "\t\tthen shortest first; optional # of words (example -c20" << endl;
+  cout << "\t\tinter, default 10)" << endl;
   cout << "\t-d Allow duplicates of same work to appear" << endl;
   cout << "\t\tmultiple times in same anagram" << endl;
   cout << "\t-e exclude (example -ealb,hello,exclude" << endl;
+  cout << "\t-f fewest words first: search 1-word, then 2-word anagrams" << endl;
+  cout << "\t\tand so on, each listed as it completes" << endl;
+  cout << "\t-g group words that are anagrams of one another on one" << endl;
+  cout << "\t\tline (example {evil|live|veil|vile} {dog|god})" << endl;
+  cout << "\t-i include: only anagrams with these words, which are" << endl;
+  cout << "\t\ttaken out of the phrase first (example -idog,cat)" << endl;
+  cout << "\t-l minimum word length (example -l3)" << endl;
+  cout << "\t-L maximum word length (example -L8)" << endl;
+  cout << "\t-m memoize sub-problems by remaining letters; optional" << endl;
+  cout << "\t\tmemory limit in MB (example -m512, default 256)" << endl;
   cout << "\t-o Output directly. This is useful for performance for" << endl;
   cout << "\t\tinputs that produce a very large # of anagrams as" << endl;
   cout << "\t\tthe system is not limited by available memory and" << endl;
   cout << "\t\tcan stream directly to disk." << endl;
+  cout << "\t-p pattern: words matching the pattern, where ? is any one" << endl;
+  cout << "\t\tletter and * any run of letters (example -p 'c?t*s').  Letters" << endl;
+  cout << "\t\tafter -p limit what the wildcards may be (example -peinrst '?a*')" << endl;
+  cout << "\t-r rarest-letter search: at each step, branch only on the words" << endl;
+  cout << "\t\tthat still fit and contain the remaining letter fewest of them" << endl;
+  cout << "\t\tcontain (finds each word combination once)" << endl;
+  cout << "\t\t(-m does not apply to this search)" << endl;
+  cout << "\t-N stop after searching this many nodes (example -N1000000)" << endl;
   cout << "\t-s print subset dictionary of partial candidate words" << endl;
-  cout << "\t-t use std::map tree structure instead of sparse hash array" << endl;
+  cout << "\t-t histogram engine:" << endl;
+  cout << "\t\t-ts sparse hash array" << endl;
+  cout << "\t\t-td dense array over the alphabet (-t alone is the same)" << endl;
+  cout << "\t\tdefault: chosen from the phrase and its alphabet" << endl;
+  cout << "\t-T stop after this many milliseconds, keeping what has" << endl;
+  cout << "\t\tbeen found (example -T500); Ctrl-C does the same" << endl;
   cout << "\t-v set verbosity:" << endl;
   cout << "\t\t-v0 terse: anagrams only, no formatting or updates" << endl;
   cout << "\t\t-v1 normal [default]" << endl;
   cout << "\t\t-v2 info" << endl;
   cout << "\t\t-v3 debug" << endl;
+  cout << "\t-w maximum words per anagram (example -w3)" << endl;
 }
 
 //
 // Threading data structures
 //
-static char chars_completed[256];
-static size_t cpu_tot;
 static anagram::Lock output_lock;
-static anagram::Lock subset_lock;
-static anagram::Lock gather_lock;
+static anagram::SearchBudget *result_budget;  // notes the first result
+static std::string included_words;   // -i words, ahead of each anagram
+static anagram::Checkpoint *checkpoint;   // --checkpoint or --resume
+static thread_local anagram::CheckpointTask *checkpoint_task;  // being run
+static size_t shard_index = 0;   // --shard: this process's part of the
+static size_t shard_tot = 0;     // search; 0 shards == all of it
 
 // PrintAnagram
 // Prints anagram followed by an endline
@@ -206,14 +424,14 @@ void PrintAnagram(const char *anagram)
 // PrintSubset
 // Prints the complete subset dictionary of candidate words for the input.
 // Entry: subset
-void PrintSubset(std::map< std::string, int >& subset, OutputQueue *queue)
+void PrintSubset(const std::vector< std::string >& subset, OutputQueue *queue)
 {
   const int kColCount = 8;
   if (queue) {
     auto column_count = kColCount;
     std::string out;
     for (const auto& i : subset) {
-      out += i.first;
+      out += i;
       if (!--column_count) {
         column_count = kColCount;
         out += "\n";
@@ -228,268 +446,1666 @@ void PrintSubset(std::map< std::string, int >& subset, OutputQueue *queue)
   }
 }
 
-// This is to ensure the output queue is not overloaded
+// This is to ensure the output queue is not overloaded.  Each thread counts
+// down its own results and adds them to the shared total when it reports.
 const int kOutputQueueThrottleFrequency = 100;
-static int output_queue_throttle = kOutputQueueThrottleFrequency;
+static thread_local int output_queue_throttle = kOutputQueueThrottleFrequency;
+static volatile long anagrams_found = 0;
+static volatile bool continue_tiers;   // -f: thread 0's call for the pass
+
+// StartPhrase
+// Starts a phrase in an output buffer with the words the user included
+// (-i), which go ahead of the ones found.  The buffer keeps its capacity
+// from one phrase to the next.
+// Entry: buffer
+void StartPhrase(std::string *phrase)
+{
+  phrase->assign(included_words);
+  if (!phrase->empty())
+    phrase->push_back(' ');
+}
+
+// EmitAnagram
+// Hands a complete anagram to the output: straight to the queue with -o,
+// otherwise onto the thread's own shard of the results (see ResultShards)
+// with a periodic progress update.  Only the shard allocates: the queue
+// copies the phrase into its own slots.  With a checkpoint, each result is
+// counted against the task being run, and those a resumed task had
+// already written are passed over.
+// Entry: anagram phrase, begun by StartPhrase (left as it was on exit)
+//        the calling thread's shard
+void EmitAnagram(
+  std::string& phrase,
+  std::vector< std::string >& output,
+  AnagramFlags flags,
+  OutputQueue *queue
+)
+{
+  result_budget->NoteResult();
+  if (flags.output_directly) {
+    CheckpointTask *task = checkpoint_task;
+    if (task && task->skip) {
+      --task->skip;
+      return;
+    }
+    phrase.push_back('\n');
+    queue->Push(phrase.c_str(), task ? &task->emitted : nullptr);
+    phrase.pop_back();
+  } else {
+    output.push_back(phrase);
+
+    if (!--output_queue_throttle) {
+      output_queue_throttle = kOutputQueueThrottleFrequency;
+      long found = __sync_add_and_fetch(&anagrams_found,
+        kOutputQueueThrottleFrequency);
+      output_lock.Acquire();
+      static char out[256];
+      sprintf(out, "\rAnagrams found: %ld    ", found);
+      queue->Push(out);
+      output_lock.Release();
+    }
+  }
+}
+
+// BeginCheckpointTask
+// With a checkpoint, notes the task the calling thread is about to run.
+// Entry: task
+void BeginCheckpointTask(const SearchTask& task)
+{
+  if (checkpoint) {
+    checkpoint_task = checkpoint->Begin(task);
+  }
+}
+
+// EndCheckpointTask
+// With a checkpoint, records the task the calling thread has run as done,
+// unless the search was stopped part way through it, and saves if it is
+// time to.
+// Entry: node meter
+//        output queue
+void EndCheckpointTask(const NodeMeter& meter, OutputQueue *queue)
+{
+  if (!checkpoint)
+    return;
+  if (!meter.Expired()) {
+    checkpoint->Finish(checkpoint_task);
+  }
+  checkpoint_task = nullptr;
+  checkpoint->SaveIfDue(queue);
+}
+
+// GatheredPartials
+// One thread's share of Step 1: the partials it found in its part of the
+// dictionary, by length, each with its class signature (see PackSubset).
+// The thread notes when it has found them all, then signs them shortest
+// first, noting each length as it is done, so that thread 0 can lay out
+// the classes of a length (see LayOutPartials) while the longer ones are
+// still being signed.
+struct GatheredPartials {
+  GatheredPartials() : bucketed(false), signed_length(0) {}
+  std::vector< std::vector< size_t > > ids;   // length -> word ids
+  std::vector< std::vector< std::string > > signatures;   // parallel to ids
+  volatile bool bucketed;         // ids are complete
+  volatile size_t signed_length;  // signatures are complete up to this
+};
+
+// PartialSet
+// The partial words, grouped into classes of words that are anagrams of one
+// another (and so have identical histograms).  The search runs over one
+// representative per class; the words of a class are only expanded on
+// output.
+// The classes are also indexed by histogram (see PackSubset), so that the
+// class spelled by exactly the letters left of a phrase is found by lookup.
+// Classes are laid out by length, longest first, with the offset at which
+// each length starts, so that a search level skips straight past the
+// classes too long for the letters left.  (Longest first also makes for a
+// smaller search than shortest first: the long words of a phrase are
+// chosen while there is the least freedom.)
+// The set is laid out a length at a time, shortest first, for the search
+// to start on while it is being laid out (see LayOutPartials).  A search
+// task only needs the classes from its first class on, which are those no
+// longer than it.  So the classes fill the arrays from the back, which are
+// sized for as many classes as there are words; the slots before
+// first_class are left empty.  The words of a length are in alphabetical
+// order, as are the words of a class.
+struct PartialSet {
+  std::vector< std::string > words;             // by length, then ascending
+  std::vector< std::vector< int > > classes;    // word indexes, ascending
+  std::vector< std::string > representatives;   // first word of each class
+  std::vector< size_t > lengths;                // letters in each class
+  std::vector< size_t > length_start;           // length -> first class
+  size_t first_class;                           // first slot in use
+  size_t min_length;                            // of any class
+  size_t max_length;                            // of any class
+  size_t master_length;                         // letters in the master
+  // length -> histogram -> class
+  std::vector< std::unordered_map< std::string, int > > signatures;
+};
+
+// FirstClassUpTo
+// Entry: partial set
+//        # of letters
+// Exit: index of the first class no longer than that; the classes after it
+//       are all no longer
+inline size_t FirstClassUpTo(const PartialSet& partial_set, size_t length)
+{
+  if (length >= partial_set.length_start.size())
+    return partial_set.first_class;
+  return partial_set.length_start[length];
+}
+
+// GetClassCounts
+// Computes the histogram of every class once, for a search to add up
+// instead of counting the letters of each word it tries.
+// Entry: partial set
+//        histograms to fill in, one per class
+template <class Hash>
+void GetClassCounts(
+  const PartialSet& partial_set,
+  std::vector< Hash > *class_counts
+)
+{
+  class_counts->resize(partial_set.representatives.size());
+  for (size_t i = partial_set.first_class;
+       i < partial_set.representatives.size(); ++i) {
+    (*class_counts)[i].clear();
+    (*class_counts)[i].GetCharCountMap(
+      partial_set.representatives[i].c_str());
+  }
+}
+
+// FindLastClass
+// Looks up the class spelled by exactly the letters left, which is the only
+// class that can end the phrase.  Only the classes no longer than the last
+// one on the path are looked at: any longer one comes before it, and those
+// may not be laid out yet.
+// Entry: partial set
+//        master count
+//        count of letters used so far
+//        # of letters left
+//        last class on the path
+//        scratch key
+// Exit: class index, or -1 if none
+template <class Hash>
+int FindLastClass(
+  const PartialSet& partial_set,
+  const Hash& master_count,
+  const Hash& used_count,
+  size_t letters_left,
+  size_t last_class,
+  std::string *key
+)
+{
+  if (letters_left > partial_set.lengths[last_class])
+    return -1;
+  const std::unordered_map< std::string, int >& signatures =
+    partial_set.signatures[letters_left];
+  if (signatures.empty())
+    return -1;
+  key->clear();
+  master_count.PackDifference(used_count, key);
+  auto found = signatures.find(*key);
+  return signatures.end() == found ? -1 : found->second;
+}
+
+// OutputScratch
+// Per-thread buffers for turning class paths into phrases.  They are sized
+// before the search starts and keep their capacity, so that output
+// allocates nothing in the search.
+struct OutputScratch {
+  std::vector< int > sorted;    // the class path, sorted
+  std::vector< int > chosen;    // word (index within its class) per position
+  std::vector< int > words;     // the words of a phrase, sorted
+  std::string phrase;           // the phrase being output
+};
+
+// ReserveOutputScratch
+// Entry: scratch
+//        most words in a phrase
+void ReserveOutputScratch(OutputScratch *scratch, size_t max_words)
+{
+  const size_t kPhraseReserve = 256;
+  scratch->sorted.reserve(max_words);
+  scratch->chosen.reserve(max_words);
+  scratch->words.reserve(max_words);
+  scratch->phrase.reserve(kPhraseReserve);
+}
+
+// ExpandClassPath
+// Emits every phrase the sorted class path in the scratch stands for.
+// Repeats of a class choose their words in ascending order, so that each
+// phrase is made once; unless duplicates are allowed, they must choose
+// different words.
+// Entry: partial set
+//        position in the path to fill
+//        scratch: sorted path, and the word chosen for each earlier position
+//        output list
+void ExpandClassPath(
+  const PartialSet& partial_set,
+  size_t position,
+  OutputScratch *scratch,
+  std::vector< std::string >& output,
+  AnagramFlags flags,
+  OutputQueue *queue
+)
+{
+  const std::vector< int >& path = scratch->sorted;
+  std::vector< int >& chosen = scratch->chosen;
+  if (position == path.size()) {
+    std::vector< int >& words = scratch->words;
+    words.resize(chosen.size());
+    for (size_t i = 0; i < chosen.size(); ++i) {
+      words[i] = partial_set.classes[path[i]][chosen[i]];
+    }
+    std::sort(words.begin(), words.end(), [&](int a, int b) {
+      return partial_set.words[a] < partial_set.words[b];
+    });
+    std::string& phrase = scratch->phrase;
+    StartPhrase(&phrase);
+    for (size_t i = 0; i < words.size(); ++i) {
+      if (i)
+        phrase += ' ';
+      phrase += partial_set.words[words[i]];
+    }
+    EmitAnagram(phrase, output, flags, queue);
+    return;
+  }
+
+  const std::vector< int >& members = partial_set.classes[path[position]];
+  size_t first = 0;
+  if (position && path[position - 1] == path[position]) {
+    first = chosen[position - 1] + (flags.allow_dupes ? 0 : 1);
+  }
+  for (size_t j = first; j < members.size(); ++j) {
+    chosen[position] = (int) j;
+    ExpandClassPath(partial_set, position + 1, scratch, output, flags, queue);
+  }
+}
+
+// EmitClassPath
+// Emits a complete combination of classes: with -g as a single grouped
+// line such as "{evil|live|veil|vile} {dog|god}", otherwise as each of the
+// phrases it stands for.
+// Entry: partial set
+//        class sequence, in any order
+//        output scratch
+//        output list
+template <class Container>
+void EmitClassPath(
+  const PartialSet& partial_set,
+  const Container& path,
+  OutputScratch *scratch,
+  std::vector< std::string >& output,
+  AnagramFlags flags,
+  OutputQueue *queue
+)
+{
+  std::vector< int >& sorted = scratch->sorted;
+  sorted.assign(path.begin(), path.end());
+  std::sort(sorted.begin(), sorted.end());
+
+  // Without duplicates a class cannot be used more times than it has words
+  if (!flags.allow_dupes) {
+    size_t run = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      run = (i && sorted[i] == sorted[i - 1]) ? run + 1 : 1;
+      if (run > partial_set.classes[sorted[i]].size())
+        return;
+    }
+  }
+
+  if (flags.group_classes) {
+    std::string& phrase = scratch->phrase;
+    StartPhrase(&phrase);
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      const std::vector< int >& members = partial_set.classes[sorted[i]];
+      if (i)
+        phrase += ' ';
+      if (1 == members.size()) {
+        phrase += partial_set.words[members[0]];
+        continue;
+      }
+      phrase += '{';
+      for (size_t j = 0; j < members.size(); ++j) {
+        if (j)
+          phrase += '|';
+        phrase += partial_set.words[members[j]];
+      }
+      phrase += '}';
+    }
+    EmitAnagram(phrase, output, flags, queue);
+    return;
+  }
+
+  scratch->chosen.resize(sorted.size());
+  ExpandClassPath(partial_set, 0, scratch, output, flags, queue);
+}
+
+// SolveRemainder
+// Finds every way of completing an anagram from classes at or after start,
+// given the letters already used.  Results are cached in the memo table
+// keyed by the remaining letters and start, so that a remainder reached
+// again along another path is looked up instead of searched.  A class may
+// repeat here; EmitClassPath drops repeats that need more words than the
+// class has.  A remainder cut short by the search budget is incomplete, so
+// it is returned but not cached.  The last word is found by FindLastClass;
+// classes are only tried one by one when there is room for two more.
+// Entry: partial set
+//        class histograms
+//        master count
+//        count of letters used so far
+//        # of letters left
+//        index of first class to try
+//        # of words that may still be added (0 == any number)
+//        scratch hashes, from scratch_depth on free for use
+//        memo table
+//        node meter
+// Exit: solutions; each is a sequence of class indexes
+template <class Hash>
+MemoEntry SolveRemainder(
+  const PartialSet& partial_set,
+  const std::vector< Hash >& class_counts,
+  Hash& master_count,
+  Hash& candidate_count_a,
+  size_t letters_left,
+  size_t start,
+  size_t words_left,
+  std::deque< Hash >& scratch,
+  size_t scratch_depth,
+  MemoTable *memo,
+  NodeMeter& meter
+)
+{
+  std::string key;
+  master_count.PackDifference(candidate_count_a, &key);
+  key.append((const char *) &start, sizeof(start));
+  key.append((const char *) &words_left, sizeof(words_left));
+  MemoEntry found = memo->Find(key);
+  if (found)
+    return found;
+
+  std::shared_ptr< MemoSolutions > solutions(new MemoSolutions());
+  solutions->count = 0;
+  if (scratch.size() <= scratch_depth) {
+    scratch.emplace_back();
+  }
+  Hash& candidate_count_b = scratch[scratch_depth];
+  int last = FindLastClass(partial_set, master_count, candidate_count_a,
+    letters_left, start, &key);
+  if (last >= (int) start) {
+    solutions->words.push_back(last);
+    solutions->words.push_back(-1);
+    ++solutions->count;
+  }
+  // Only classes that leave room for another word are tried
+  size_t first = start, partials_end = start;
+  if (1 != words_left && letters_left >= 2 * partial_set.min_length) {
+    first = std::max(start, FirstClassUpTo(partial_set,
+      std::min(letters_left - partial_set.min_length,
+        partial_set.lengths[start])));
+    partials_end = partial_set.classes.size();
+  }
+  for (size_t i = first; i < partials_end; ++i) {
+    if (!meter.Visit())
+      break;
+    candidate_count_b = class_counts[i];
+    candidate_count_b += candidate_count_a;
+    int comparison_result = candidate_count_b.Compare(master_count);
+    if (comparison_result < 0) {
+      MemoEntry rest = SolveRemainder(partial_set, class_counts, master_count,
+        candidate_count_b, letters_left - partial_set.lengths[i], i,
+        words_left ? words_left - 1 : 0, scratch, scratch_depth + 1, memo,
+        meter);
+      // Prefix this class onto each solution of the remainder
+      bool new_solution = true;
+      for (int w : rest->words) {
+        if (new_solution)
+          solutions->words.push_back((int) i);
+        solutions->words.push_back(w);
+        new_solution = (w < 0);
+      }
+      solutions->count += rest->count;
+    }
+  }
+  solutions->words.shrink_to_fit();
+  if (meter.Expired())
+    return solutions;
+  memo->Insert(key, solutions);
+  return solutions;
+}
+
+// SearchScratch
+// Per-thread state for the combination search.  It is set up at the first
+// task (see PrepareSearchScratch) so that the search itself makes no heap
+// allocations: the path is a stack of class ids, the per-depth sums are
+// there for the deepest path, and a phrase is only rendered, into the
+// output scratch, when it is emitted.  The memo table (-m) is the
+// exception; its entries are allocated as they are cached.  The class
+// histograms are filled in as tasks need them (see CountClassesFrom).
+template <class Hash>
+struct SearchScratch {
+  Hash master_count;
+  std::vector< Hash > class_counts;   // histogram of each class
+  size_t counted_from;                // first class with its histogram
+  std::deque< Hash > counts;          // per-depth sums (a deque, so that
+                                      // growing it keeps references valid)
+  std::vector< int > path;            // classes chosen so far
+  std::string key;                    // for FindLastClass
+  OutputScratch output;
+};
+
+// MaxPathLength
+// Entry: partial set
+//        word limit (0 == none)
+// Exit: most classes an anagram can have
+inline size_t MaxPathLength(const PartialSet& partial_set, size_t max_words)
+{
+  size_t most = partial_set.min_length ?
+    partial_set.master_length / partial_set.min_length : 0;
+  if (max_words && max_words < most)
+    most = max_words;
+  return most;
+}
+
+// PrepareSearchScratch
+// Entry: master word/phrase
+//        partial set
+//        word limit (0 == none)
+//        scratch to set up
+template <class Hash>
+void PrepareSearchScratch(
+  const char *word,
+  const PartialSet& partial_set,
+  size_t max_words,
+  SearchScratch< Hash > *scratch
+)
+{
+  size_t max_path = MaxPathLength(partial_set, max_words);
+  scratch->master_count.clear();
+  scratch->master_count.GetCharCountMap(word);
+  scratch->class_counts.resize(partial_set.classes.size());
+  scratch->counted_from = partial_set.classes.size();
+  // One sum per level and one for the level below the deepest, which
+  // SolveRemainder takes before finding there is no room
+  while (scratch->counts.size() < max_path + 2) {
+    scratch->counts.emplace_back();
+  }
+  scratch->path.reserve(max_path + 1);
+  // Every key holds one count per letter of the master
+  scratch->key.clear();
+  scratch->master_count.PackSubset(scratch->master_count, &scratch->key);
+  ReserveOutputScratch(&scratch->output, max_path + 1);
+}
+
+// CountClassesFrom
+// Computes the histograms of the classes from first on that the scratch
+// does not have yet.  A task's classes are laid out before it is queued.
+// Entry: partial set
+//        first class a task needs
+//        scratch
+template <class Hash>
+void CountClassesFrom(
+  const PartialSet& partial_set,
+  size_t first,
+  SearchScratch< Hash > *scratch
+)
+{
+  while (scratch->counted_from > first) {
+    Hash& count = scratch->class_counts[--scratch->counted_from];
+    count.clear();
+    count.GetCharCountMap(
+      partial_set.representatives[scratch->counted_from].c_str());
+  }
+}
 
 // CombineSubsetsRecurseFast
 // Recurse into subsets, additively updating candidate count.
 // We have a candidate count passed in, and we will compare
-/// against the other words to get the second candidate count.
+/// against the other classes to get the second candidate count.
 // until we reach a full combo.
-// Entry: word
-//        subset map
-//        output map
+// Classes are tried from start on, start itself included: a class may
+// recur as long as it has words left to fill it (or always, with -d).
+// Paths are thus nondecreasing, so each multiset of classes is reached
+// once, and ExpandClassPath makes each multiset of words from it once.
+// The last word is not searched for: FindLastClass looks up the class that
+// the letters left spell, and classes are only tried one by one as words
+// that leave room for at least one more.
+// At the first level, if other threads are out of work, two-class prefixes
+// are handed to the work queue instead of being searched here.
+// The search stops at the word limit and unwinds once the budget is spent.
+// Entry: scratch, with the classes chosen so far
+//        partial set
+//        output list
 //        candidate combo
+//        index of first class to try
+//        node meter (for the search limits and budget)
+template <class Hash>
 void CombineSubsetsRecurseFast(
+  SearchScratch< Hash >& scratch,
+  const PartialSet& partial_set,
+  std::vector< std::string >& output,
+  Hash& candidate_count_a,
+  Hash& candidate_count_b,
+  size_t start,
+  AnagramFlags flags,
+  OutputQueue *queue,
+  WorkStealingQueue *work_queue,
+  MemoTable *memo,
+  NodeMeter& meter,
+  int thread_index,
+  int depth
+)
+{
+  using namespace std;
+  const SearchLimits& limits = meter.GetLimits();
+  vector< int >& path = scratch.path;
+  const vector< Hash >& class_counts = scratch.class_counts;
+  Hash& master_count = scratch.master_count;
+  deque< Hash >& candidate_count_arr = scratch.counts;
+  if (limits.max_words && path.size() >= limits.max_words)
+    return;
+  // Whether a class added here may be followed by more
+  bool room = !limits.max_words || path.size() + 1 < limits.max_words;
+  // Disallow another use of the start class once its words are used up,
+  // if dupes are disallowed.
+  if (!flags.allow_dupes &&
+      (size_t) count(path.begin(), path.end(), (int) start) >=
+      partial_set.classes[start].size()) {
+    ++start;
+  }
+
+  size_t letters_left = partial_set.master_length;
+  for (int c : path) {
+    letters_left -= partial_set.lengths[c];
+  }
+  if (limits.max_words && letters_left >
+      (limits.max_words - path.size()) * partial_set.max_length)
+    return;   // too many letters left for the words left
+
+  // A resumed task picks up at the second class it had got to (see
+  // Checkpoint::Progress); what came before, the lookup below included, is
+  // in the output already.
+  size_t resume_at = (!depth && checkpoint_task) ?
+    checkpoint_task->resume_at : 0;
+
+  // The class spelled by exactly the letters left completes the anagram.
+  int last = FindLastClass(partial_set, master_count, candidate_count_a,
+    letters_left, path.back(), &scratch.key);
+  if (!resume_at && last >= (int) start &&
+      path.size() + 1 >= limits.min_words) {
+    path.push_back(last);
+    EmitClassPath(partial_set, path, &scratch.output, output, flags, queue);
+    path.pop_back();
+  }
+
+  if (!room || letters_left < 2 * partial_set.min_length)
+    return;   // no room for two more words
+  // Classes are by length; those before this one would leave too few
+  // letters for another word.  (Those longer than the last class on the
+  // path come before start anyway, and may not be laid out yet.)
+  size_t first = max(start, FirstClassUpTo(partial_set,
+    min(letters_left - partial_set.min_length,
+      partial_set.lengths[path.back()])));
+  first = max(first, resume_at);
+  for (size_t i = first; i < partial_set.classes.size(); ++i) {
+    if (!meter.Visit())
+      return;
+    candidate_count_b = class_counts[i];
+
+    // This checks whether the candidates still fit in the master. This is
+    // determined by a lexically-equivalent permutation (same character
+    // counts in different permutation).  Sum stored in candidate_count_b.
+    // A complete anagram here was already found by the lookup above.
+    candidate_count_b += candidate_count_a;
+    int comparison_result = candidate_count_b.Compare(master_count);
+
+    if (comparison_result < 0) {
+      // The two candidates do not make a full anagram; Since the letter count
+      // permutation is still less than that of master, the two candidates
+      // combined still form a partial.
+      if (!depth && checkpoint_task && find(checkpoint_task->split.begin(),
+          checkpoint_task->split.end(), (int) i) !=
+          checkpoint_task->split.end()) {
+        continue;   // handed off before a resume; a task of its own
+      }
+      if (!depth && work_queue->Hungry() &&
+          !(checkpoint_task && checkpoint_task->skip)) {
+        // Another thread is idle; give it this two-class prefix.  (A
+        // resumed task keeps what it had written before to itself.)
+        SearchTask task = { path[0], (int) i };
+        if (checkpoint_task) {
+          checkpoint->Split(checkpoint_task, task);
+        }
+        work_queue->Push(thread_index, task);
+        continue;
+      }
+      // Below, we add the class to the path and recurse.
+      if (candidate_count_arr.size() <= (size_t) depth) {
+        candidate_count_arr.emplace_back();
+      }
+      candidate_count_arr[depth] = candidate_count_b;
+      path.push_back((int) i);
+      if (memo) {
+        // Below the first class the remainder depends only on the letters
+        // left and the start position, so it can come from the memo.
+        MemoEntry rest = SolveRemainder(partial_set, class_counts,
+          master_count, candidate_count_arr[depth],
+          letters_left - partial_set.lengths[i],
+          i, limits.max_words ? limits.max_words - path.size() : 0,
+          candidate_count_arr, depth + 1, memo, meter);
+        size_t prefix_len = path.size();
+        for (int w : rest->words) {
+          if (w < 0) {
+            if (path.size() >= limits.min_words)
+              EmitClassPath(partial_set, path, &scratch.output, output, flags,
+                queue);
+            path.resize(prefix_len);
+          } else {
+            path.push_back(w);
+          }
+        }
+      } else {
+        CombineSubsetsRecurseFast(
+          scratch,
+          partial_set,
+          output,
+          candidate_count_arr[depth],
+          candidate_count_b,
+          i,
+          flags,
+          queue,
+          work_queue,
+          memo,
+          meter,
+          thread_index,
+          depth + 1
+        );
+      }
+      path.pop_back();
+      if (!depth && checkpoint_task && !meter.Expired()) {
+        checkpoint->Progress(checkpoint_task, (int) i + 1);
+      }
+    } else {
+      // The two candidates exceed the lexical permutative value of the
+      // master, or use it up exactly (found above); continue on...
+    }
+  }
+}
+
+// LetterIndex
+// For rarest-letter search (-r): the lanes of the master's letters, rarest
+// first, and for each the classes (ascending index) that contain it.
+struct LetterIndex {
+  std::vector< size_t > lanes;
+  std::vector< std::vector< int > > words;  // parallel to lanes
+};
+
+// BuildLetterIndex
+// Entry: master count
+//        partial set
+//        index to fill in
+template <class Hash>
+void BuildLetterIndex(
+  Hash& master_count,
+  const PartialSet& partial_set,
+  LetterIndex *letter_index
+)
+{
+  typedef typename Hash::alphabet_type Alphabet;
+  std::vector< Hash > partial_counts;
+  GetClassCounts(partial_set, &partial_counts);
+
+  std::vector< std::pair< size_t, size_t > > by_rarity; // (# of words, lane)
+  std::vector< std::vector< int > > words(Alphabet::LaneCount());
+  for (size_t lane = 0; lane < Alphabet::LaneCount(); ++lane) {
+    if (!master_count.GetCharCount(lane))
+      continue;
+    for (size_t i = partial_set.first_class; i < partial_counts.size(); ++i) {
+      if (partial_counts[i].GetCharCount(lane))
+        words[lane].push_back((int) i);
+    }
+    by_rarity.push_back(std::make_pair(words[lane].size(), lane));
+  }
+  std::sort(by_rarity.begin(), by_rarity.end());
+
+  letter_index->lanes.clear();
+  letter_index->words.clear();
+  for (const auto& i : by_rarity) {
+    letter_index->lanes.push_back(i.second);
+    letter_index->words.push_back(words[i.second]);
+  }
+}
+
+// RarestLetterSearch
+// Per-thread state for rarest-letter search.
+template <class Hash>
+struct RarestLetterSearch {
+  const PartialSet *partial_set;
+  const LetterIndex *letter_index;
+  std::vector< std::string > *output;
+  AnagramFlags flags;
+  OutputQueue *queue;
+  NodeMeter *meter;
+  Hash master_count;
+  std::vector< Hash > partial_counts;
+  std::deque< Hash > sums;      // per-depth scratch
+  std::vector< int > excluded;  // per class; nonzero == not allowed here
+  std::vector< int > marks;     // classes excluded so far, as a stack
+  std::vector< size_t > uses;   // per class; # of times on the path
+  std::vector< int > path;      // classes chosen so far
+  OutputScratch output_scratch;
+};
+
+// CountFittingClasses
+// Counts the classes with a letter that could still be added: not excluded,
+// with words left, and within the letters left.  Counting stops at limit.
+// Entry: search state
+//        position of the letter in the letter index
+//        count of letters used so far
+//        # of letters left
+//        limit
+//        scratch count
+// Exit: # of classes, up to limit
+template <class Hash>
+size_t CountFittingClasses(
+  RarestLetterSearch< Hash >& search,
+  size_t k,
+  const Hash& used_count,
+  size_t letters_left,
+  size_t limit,
+  Hash& sum
+)
+{
+  const std::vector< size_t >& lengths = search.partial_set->lengths;
+  const std::vector< int >& with_letter = search.letter_index->words[k];
+  auto first = std::partition_point(with_letter.begin(), with_letter.end(),
+    [&](int w) { return lengths[w] > letters_left; });
+  size_t count = 0;
+  for (auto it = first; it != with_letter.end() && count < limit; ++it) {
+    int w = *it;
+    if (search.excluded[w])
+      continue;
+    if (!search.flags.allow_dupes &&
+        search.uses[w] >= search.partial_set->classes[w].size())
+      continue;
+    sum = used_count;
+    sum += search.partial_counts[w];
+    if (sum.Compare(search.master_count) <= 0)
+      ++count;
+  }
+  return count;
+}
+
+// CombineSubsetsRarestRecurse
+// Any anagram must use every letter still remaining, so at each level the
+// remaining letter with the fewest classes that can still be added (see
+// CountFittingClasses) is picked, and only those classes are branched on; a
+// letter no such class can supply ends the branch at once.  The letters are
+// counted in the order of the letter index, which is rarest first over the
+// whole partial set, so that a small count is found early and cuts the
+// counting of the rest short.  To find each combination of classes once, a
+// class that has been branched on is excluded from the later branches at
+// that level.  Within its own branch it may recur while it has words left
+// (always, if duplicates are allowed).  The classes with a letter are listed
+// longest first, so a branch starts at the first class that is not longer
+// than the letters left.  The search stops at the word limit and unwinds
+// once the budget is spent.
+// Entry: search state
+//        count of letters used so far
+//        # of letters left
+//        depth (index into the scratch sums)
+template <class Hash>
+void CombineSubsetsRarestRecurse(
+  RarestLetterSearch< Hash >& search,
+  const Hash& used_count,
+  size_t letters_left,
+  size_t depth
+)
+{
+  const LetterIndex& letter_index = *search.letter_index;
+  size_t max_words = search.meter->GetLimits().max_words;
+  if (max_words && search.path.size() >= max_words)
+    return;
+  if (search.sums.size() <= depth) {
+    search.sums.emplace_back();
+  }
+  Hash& sum = search.sums[depth];
+
+  size_t k = 0;
+  size_t fewest = (size_t) -1;
+  for (size_t i = 0; i < letter_index.lanes.size() && fewest; ++i) {
+    size_t lane = letter_index.lanes[i];
+    if (used_count.GetCharCount(lane) >= search.master_count.GetCharCount(lane))
+      continue;
+    size_t count = CountFittingClasses(search, i, used_count, letters_left,
+      fewest, sum);
+    if (count < fewest) {
+      fewest = count;
+      k = i;
+    }
+  }
+  if (!fewest)
+    return;   // a letter left that nothing can supply
+
+  size_t mark_base = search.marks.size();
+  // The classes with the letter are longest first; skip those too long
+  const std::vector< size_t >& lengths = search.partial_set->lengths;
+  const std::vector< int >& with_letter = letter_index.words[k];
+  auto first = std::partition_point(with_letter.begin(), with_letter.end(),
+    [&](int w) { return lengths[w] > letters_left; });
+  for (auto it = first; it != with_letter.end(); ++it) {
+    int w = *it;
+    if (!search.meter->Visit())
+      break;
+    if (search.excluded[w])
+      continue;
+    if (!search.flags.allow_dupes &&
+        search.uses[w] >= search.partial_set->classes[w].size())
+      continue;
+    sum = used_count;
+    sum += search.partial_counts[w];
+    int comparison_result = sum.Compare(search.master_count);
+    if (comparison_result > 0)
+      continue;   // does not fit here, nor anywhere further down
+
+    ++search.uses[w];
+    search.path.push_back(w);
+    if (!comparison_result) {
+      if (search.path.size() >= search.meter->GetLimits().min_words)
+        EmitClassPath(*search.partial_set, search.path, &search.output_scratch,
+          *search.output, search.flags, search.queue);
+    } else {
+      CombineSubsetsRarestRecurse(search, sum, letters_left - lengths[w],
+        depth + 1);
+    }
+    search.path.pop_back();
+    --search.uses[w];
+    ++search.excluded[w];
+    search.marks.push_back(w);
+  }
+
+  while (search.marks.size() > mark_base) {
+    --search.excluded[search.marks.back()];
+    search.marks.pop_back();
+  }
+}
+
+// CombineSubsetsRarest
+// Rarest-letter counterpart of CombineSubsetsFast.  Tasks are positions in
+// the class list of the master's rarest letter; a task re-creates the
+// exclusions its earlier siblings would have left.
+// Entry: master word/phrase
+//        partial set
+//        letter index
+//        output list
+//        tier: exact # of words per anagram for this pass (0 == any)
+template <class Hash>
+void CombineSubsetsRarest(
   const char *word,
-  std::map< std::string, int >& subset,
-  std::map< std::string, int >& output,
-  OccupancyHash& master_count,
-  OccupancyHash& candidate_count_a,
-  OccupancyHash& candidate_count_b,
-  OccupancyHash *candidate_count_arr[],
-  std::map<std::string, int>::const_iterator& start_i,
+  const PartialSet& partial_set,
+  const LetterIndex& letter_index,
+  std::vector< std::string >& output,
+  AnagramFlags flags,
+  int thread_index,
+  WorkStealingQueue *work_queue,
+  SearchBudget *budget,
+  size_t tier,
+  OutputQueue *queue
+)
+{
+  NodeMeter meter(budget);
+  if (tier) {
+    meter.SetWordRange(tier, tier);
+  }
+  RarestLetterSearch< Hash > search;
+  search.partial_set = &partial_set;
+  search.letter_index = &letter_index;
+  search.output = &output;
+  search.flags = flags;
+  search.queue = queue;
+  search.meter = &meter;
+  search.master_count.GetCharCountMap(word);
+  GetClassCounts(partial_set, &search.partial_counts);
+  search.excluded.assign(partial_set.classes.size(), 0);
+  search.uses.assign(partial_set.classes.size(), 0);
+  // Sized up front, like SearchScratch, so that the search allocates nothing
+  size_t max_path = MaxPathLength(partial_set, meter.GetLimits().max_words);
+  while (search.sums.size() < max_path + 1) {
+    search.sums.emplace_back();
+  }
+  search.marks.reserve(2 * partial_set.classes.size());
+  search.path.reserve(max_path + 1);
+  ReserveOutputScratch(&search.output_scratch, max_path + 1);
+  size_t allocations = GetThreadAllocations();
+
+  const std::vector< int >& first_words = letter_index.words[0];
+  SearchTask task;
+  while (!work_queue->Finished()) {
+    if (!work_queue->Pop(thread_index, &task)) {
+      sched_yield();
+      continue;
+    }
+    BeginCheckpointTask(task);
+    for (int i = 0; i < task.first; ++i) {
+      ++search.excluded[first_words[i]];
+      search.marks.push_back(first_words[i]);
+    }
+    int w = first_words[task.first];
+    int comparison_result =
+      search.partial_counts[w].Compare(search.master_count);
+    ++search.uses[w];
+    search.path.push_back(w);
+    if (!comparison_result) {
+      if (meter.GetLimits().min_words <= 1)
+        EmitClassPath(partial_set, search.path, &search.output_scratch,
+          output, flags, queue);
+    } else if (comparison_result < 0) {
+      CombineSubsetsRarestRecurse(search, search.partial_counts[w],
+        partial_set.master_length - partial_set.lengths[w], 0);
+    }
+    search.path.pop_back();
+    --search.uses[w];
+    while (!search.marks.empty()) {
+      --search.excluded[search.marks.back()];
+      search.marks.pop_back();
+    }
+    EndCheckpointTask(meter, queue);
+    work_queue->Done();
+  }
+  budget->NoteAllocations(GetThreadAllocations() - allocations);
+}
+
+// CombineSubsetsFast
+// Given an input of a master word/phrase, find all combinations of partial words
+// to create complete anagrams.  Spaces in master word are ignored.
+// Each thread runs this, taking first-class and two-class-prefix tasks from
+// the work queue until every branch has been searched.
+// Entry: master word/phrase
+//        partial set
+//        output list
+//        tier: exact # of words per anagram for this pass (0 == any)
+template <class Hash>
+void CombineSubsetsFast(
+  const char *word,
+  const PartialSet& partial_set,
+  std::vector< std::string >& output,
+  AnagramFlags flags,
+  int thread_index,
+  WorkStealingQueue *work_queue,
+  MemoTable *memo,
+  SearchBudget *budget,
+  size_t tier,
+  OutputQueue *queue
+)
+{
+  NodeMeter meter(budget);
+  if (tier) {
+    meter.SetWordRange(tier, tier);
+  }
+  SearchScratch< Hash > scratch;
+  bool prepared = false;
+  Hash candidate_count_a, candidate_count_b;
+  std::vector< int >& path = scratch.path;
+  size_t allocations = 0;
+
+  SearchTask task;
+  while (!work_queue->Finished()) {
+    if (!work_queue->Pop(thread_index, &task)) {
+      sched_yield();  // others are still busy and may yet split their work
+      continue;
+    }
+    // The partial set may still be being laid out (see LayOutPartials)
+    // until the first task comes
+    if (!prepared) {
+      PrepareSearchScratch(word, partial_set, meter.GetLimits().max_words,
+        &scratch);
+      allocations = GetThreadAllocations();
+      prepared = true;
+    }
+    CountClassesFrom(partial_set, task.first, &scratch);
+    BeginCheckpointTask(task);
+
+    path.assign(1, task.first);
+    if (task.second < 0) {
+      // The whole branch below a first class
+      candidate_count_a = scratch.class_counts[task.first];
+      CombineSubsetsRecurseFast(
+          scratch,
+          partial_set,
+          output,
+          candidate_count_a,
+          candidate_count_b,
+          task.first,
+          flags,
+          queue,
+          work_queue,
+          memo,
+          meter,
+          thread_index,
+          0
+      );
+    } else {
+      // The branch below a two-class prefix split off by another thread;
+      // this picks up exactly where that thread's first level left off.
+      path.push_back(task.second);
+      Hash& prefix_count = scratch.counts[0];
+      prefix_count = scratch.class_counts[task.first];
+      prefix_count += scratch.class_counts[task.second];
+      CombineSubsetsRecurseFast(
+          scratch,
+          partial_set,
+          output,
+          prefix_count,
+          candidate_count_b,
+          task.second,
+          flags,
+          queue,
+          work_queue,
+          memo,
+          meter,
+          thread_index,
+          1
+      );
+    }
+    EndCheckpointTask(meter, queue);
+    work_queue->Done();
+  }
+  if (prepared) {
+    budget->NoteAllocations(GetThreadAllocations() - allocations);
+  }
+}
+
+// WaysToChoose
+// Entry: # of words in a class
+//        # of times the class is used
+//        true == a word may be used more than once (-d)
+// Exit: # of ways of picking the words, ignoring order
+size_t WaysToChoose(size_t n, size_t m, bool repeats)
+{
+  if (repeats)
+    n += m - 1;
+  if (m > n)
+    return 0;
+  size_t ways = 1;
+  for (size_t i = 1; i <= m; ++i) {
+    ways = ways * (n - m + i) / i;  // exact: a product of i integers
+  }
+  return ways;
+}
+
+// Remainders with no more than this many classes that fit are not memoized
+const size_t kCountMemoMinClasses = 16;
+
+// ClassCounter
+// Per-thread state for counting anagrams (--count).
+template <class Hash>
+struct ClassCounter {
+  const PartialSet *partial_set;
+  AnagramFlags flags;
+  MemoTable *memo;
+  NodeMeter *meter;
+  Hash master_count;
+  std::vector< Hash > class_counts;
+  std::deque< Hash > sums;                    // per-depth scratch
+  std::deque< std::vector< int > > fitting;   // per-depth scratch
+};
+
+template <class Hash>
+size_t CountRemainder(ClassCounter< Hash >& counter, const Hash& used_count,
+  size_t letters_left, const std::vector< int >& candidates, size_t position,
+  size_t words_left, size_t depth);
+
+// CountWithClass
+// Counts the phrases completing an anagram whose first (lowest) class is
+// candidates[position], given the letters already used.  The class is taken
+// once, twice and so on while it fits, and each multiplicity is weighted by
+// the # of ways of choosing that many of its words, so that every phrase a
+// class path stands for is counted without being built.
+// Entry: counter state
+//        count of letters used so far
+//        # of letters left
+//        classes that fit the letters left, ascending
+//        position of the class in candidates
+//        # of words that may still be added (0 == any number)
+//        depth (index into the scratch)
+// Exit: # of phrases
+template <class Hash>
+size_t CountWithClass(
+  ClassCounter< Hash >& counter,
+  const Hash& used_count,
+  size_t letters_left,
+  const std::vector< int >& candidates,
+  size_t position,
+  size_t words_left,
+  size_t depth
+)
+{
+  while (counter.sums.size() <= depth) {
+    counter.sums.emplace_back();
+  }
+  Hash& sum = counter.sums[depth];
+  sum = used_count;
+  int class_index = candidates[position];
+  size_t class_size = counter.partial_set->classes[class_index].size();
+  size_t class_length = counter.partial_set->lengths[class_index];
+  size_t total = 0;
+  for (size_t m = 1; ; ++m) {
+    if (!counter.meter->Visit())
+      break;
+    if (!counter.flags.allow_dupes && m > class_size)
+      break;
+    if (words_left && m > words_left)
+      break;
+    if (class_length > letters_left)
+      break;
+    letters_left -= class_length;
+    sum += counter.class_counts[class_index];
+    int comparison_result = sum.Compare(counter.master_count);
+    if (comparison_result > 0)
+      break;
+    size_t ways = WaysToChoose(class_size, m, counter.flags.allow_dupes);
+    if (!comparison_result) {
+      total += ways;
+      break;
+    }
+    if (words_left != m) {
+      total += ways * CountRemainder(counter, sum, letters_left, candidates,
+        position + 1, words_left ? words_left - m : 0, depth + 1);
+    }
+  }
+  return total;
+}
+
+// CountRemainder
+// Counts the phrases completing an anagram from the candidate classes at or
+// after position, given the letters already used.  Only the candidates that
+// still fit are tried, and they are handed on as the next level's
+// candidates, so the list shrinks as the search deepens; being by length,
+// longest first, the classes too long for the letters left are skipped.  Counts are cached
+// in the memo table keyed, like SolveRemainder's solutions, by the letters
+// left and the first class; a count cut short by the search budget is not
+// cached.
+// Entry: counter state
+//        count of letters used so far
+//        # of letters left
+//        classes that fit the letters left before the last addition
+//        position of the first class to try in candidates
+//        # of words that may still be added (0 == any number)
+//        depth (index into the scratch)
+// Exit: # of phrases
+template <class Hash>
+size_t CountRemainder(
+  ClassCounter< Hash >& counter,
+  const Hash& used_count,
+  size_t letters_left,
+  const std::vector< int >& candidates,
+  size_t position,
+  size_t words_left,
+  size_t depth
+)
+{
+  while (counter.sums.size() <= depth) {
+    counter.sums.emplace_back();
+  }
+  while (counter.fitting.size() <= depth) {
+    counter.fitting.emplace_back();
+  }
+  Hash& probe = counter.sums[depth];
+  std::vector< int >& fitting = counter.fitting[depth];
+  fitting.clear();
+  const std::vector< size_t >& lengths = counter.partial_set->lengths;
+  auto first = std::partition_point(candidates.begin() + position,
+    candidates.end(), [&](int c) { return lengths[c] > letters_left; });
+  for (auto it = first; it != candidates.end(); ++it) {
+    probe = used_count;
+    probe += counter.class_counts[*it];
+    if (probe.Compare(counter.master_count) <= 0)
+      fitting.push_back(*it);
+  }
+  if (fitting.empty())
+    return 0;
+
+  // The first class that fits stands for the start; remainders with only a
+  // few classes left are quicker to count again than to look up.
+  std::string key;
+  bool memoize = fitting.size() > kCountMemoMinClasses;
+  if (memoize) {
+    int start = fitting[0];
+    counter.master_count.PackDifference(used_count, &key);
+    key.append((const char *) &start, sizeof(start));
+    key.append((const char *) &words_left, sizeof(words_left));
+    MemoEntry found = counter.memo->Find(key);
+    if (found)
+      return found->count;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < fitting.size() && !counter.meter->Expired(); ++i) {
+    total += CountWithClass(counter, used_count, letters_left, fitting, i,
+      words_left, depth);
+  }
+
+  if (memoize && !counter.meter->Expired()) {
+    std::shared_ptr< MemoSolutions > solutions(new MemoSolutions());
+    solutions->count = total;
+    counter.memo->Insert(key, solutions);
+  }
+  return total;
+}
+
+// CountSubsets
+// Counting counterpart of CombineSubsetsFast (--count): each task counts
+// the anagrams whose lowest class is the task's first class, and the
+// totals are summed into the shared count.
+// Entry: master word/phrase
+//        partial set
+//        shared anagram count
+template <class Hash>
+void CountSubsets(
+  const char *word,
+  const PartialSet& partial_set,
+  size_t *anagram_count,
+  AnagramFlags flags,
+  int thread_index,
+  WorkStealingQueue *work_queue,
+  MemoTable *memo,
+  SearchBudget *budget
+)
+{
+  NodeMeter meter(budget);
+  ClassCounter< Hash > counter;
+  counter.partial_set = &partial_set;
+  counter.flags = flags;
+  counter.memo = memo;
+  counter.meter = &meter;
+  counter.master_count.GetCharCountMap(word);
+  GetClassCounts(partial_set, &counter.class_counts);
+
+  // Every partial fits the master, so all classes are candidates at first
+  std::vector< int > all_classes;
+  for (size_t i = partial_set.first_class; i < partial_set.classes.size();
+       ++i) {
+    all_classes.push_back((int) i);
+  }
+
+  Hash none;
+  size_t total = 0;
+  SearchTask task;
+  while (!work_queue->Finished()) {
+    if (!work_queue->Pop(thread_index, &task)) {
+      sched_yield();
+      continue;
+    }
+    if (!meter.Expired()) {
+      total += CountWithClass(counter, none, partial_set.master_length,
+        all_classes, task.first - partial_set.first_class,
+        meter.GetLimits().max_words, 0);
+    }
+    work_queue->Done();
+  }
+  __sync_fetch_and_add(anagram_count, total);
+}
+
+// QueueTaskRange
+// Queues one task per first class in the range, dealt round-robin so that
+// every thread starts with local work.  With a checkpoint, the tasks that
+// are done are left out (see Checkpoint::QueueTasks); a shard of the search
+// (--shard) takes every shard_tot-th class only.
+// Entry: first of the first classes
+//        end of the first classes
+//        work queue
+void QueueTaskRange(size_t first, size_t end, WorkStealingQueue *work_queue)
+{
+  if (checkpoint) {
+    checkpoint->QueueTasks(first, end, work_queue);
+    return;
+  }
+  size_t queued = 0;
+  for (size_t i = first; i < end; ++i) {
+    if (shard_tot && i % shard_tot != shard_index)
+      continue;
+    SearchTask task = { (int) i, -1 };
+    work_queue->Push(queued++ % work_queue->GetThreadTot(), task);
+  }
+}
+
+// QueueFirstClasses
+// Queues one task per first class.  For rarest-letter search the first
+// classes are those with the master's rarest letter, by their position in
+// its list.
+// Entry: partial set
+//        letter index (for -r)
+//        work queue
+void QueueFirstClasses(
+  const PartialSet& partial_set,
+  const LetterIndex& letter_index,
+  AnagramFlags flags,
+  WorkStealingQueue *work_queue
+)
+{
+  if (flags.rarest_first) {
+    QueueTaskRange(0, letter_index.lanes.empty() ?
+      0 : letter_index.words[0].size(), work_queue);
+  } else {
+    QueueTaskRange(partial_set.first_class, partial_set.classes.size(),
+      work_queue);
+  }
+}
+
+// PipelinesGathering
+// Whether the search starts on the classes of each length as soon as they
+// are laid out (see LayOutPartials), while longer ones are still being
+// gathered.  The others need every class first: -r picks its first classes
+// by the letters of all of them, -f queues a pass at a time, --count takes
+// every class as a candidate, and -s lists the partials ahead of the
+// anagrams.
+// Entry: flags
+inline bool PipelinesGathering(AnagramFlags flags)
+{
+  return !flags.rarest_first && !flags.fewest_first && !flags.count_only &&
+    !flags.print_subset;
+}
+
+// LayOutPartials
+// Thread 0's part of Step 1: groups the partials gathered by every thread
+// into classes and lays them out in the partial set, a length at a time,
+// shortest first, as soon as every thread has signed its partials of that
+// length.  When the search is pipelined (see PipelinesGathering), the
+// tasks of each length's classes are queued as soon as they are laid out,
+// since a task only needs the classes no longer than its first.
+// Entry: dictionary index
+//        partials gathered by each thread
+//        # of letters in the master
+//        partial set to fill in
+//        work queue
+//        output queue (for -s)
+void LayOutPartials(
+  const DictionaryIndex& dictionary_index,
+  std::vector< GatheredPartials >& gathered,
+  size_t master_length,
+  PartialSet& partial_set,
   AnagramFlags flags,
-  OutputQueue *queue,
-  int depth
+  WorkStealingQueue *work_queue,
+  OutputQueue *queue
 )
 {
   using namespace std;
-  for (auto i = start_i; i != subset.end(); ++i) {
-    // Disallow candidacy of already-processed word if dupes are disallowed.
-    if (!flags.allow_dupes && !strcmp(i->first.c_str(), word))
+  // How many partials there are of each length is known before any of
+  // them are signed, so the arrays are sized once, for the search to read
+  // while they are filled in.
+  size_t word_tot = 0;
+  partial_set.master_length = master_length;
+  partial_set.min_length = master_length;
+  partial_set.max_length = 0;
+  for (const auto& part : gathered) {
+    while (!part.bucketed) {
+      sched_yield();
+    }
+    __sync_synchronize();
+    for (size_t length = 1; length < part.ids.size(); ++length) {
+      if (part.ids[length].empty())
+        continue;
+      word_tot += part.ids[length].size();
+      partial_set.min_length = min(partial_set.min_length, length);
+      partial_set.max_length = max(partial_set.max_length, length);
+    }
+  }
+  partial_set.words.resize(word_tot);
+  partial_set.classes.resize(word_tot);
+  partial_set.representatives.resize(word_tot);
+  partial_set.lengths.resize(word_tot);
+  partial_set.signatures.resize(master_length + 1);
+  partial_set.length_start.assign(master_length + 1, word_tot);
+  partial_set.first_class = word_tot;
+
+  bool pipelined = PipelinesGathering(flags);
+  size_t next_word = 0;
+  size_t shorter = 0;   // the longest length laid out so far
+  vector< pair< const string *, const string * > > merged;  // word, key
+  vector< vector< int > > classes;
+  vector< const string * > keys;
+  unordered_map< string, int > class_of;
+  for (size_t length = partial_set.min_length;
+       length <= partial_set.max_length; ++length) {
+    merged.clear();
+    for (const auto& part : gathered) {
+      while (part.signed_length < length) {
+        sched_yield();
+      }
+      __sync_synchronize();
+      const vector< size_t >& ids = part.ids[length];
+      for (size_t i = 0; i < ids.size(); ++i) {
+        merged.push_back(make_pair(&dictionary_index.GetWord(ids[i]),
+          &part.signatures[length][i]));
+      }
+    }
+    if (merged.empty())
       continue;
-
-    candidate_count_b.clear();
-    candidate_count_b.GetCharCountMap(i->first.c_str());
-
-    // This checks to for a complete anagram assembled from partials. This is
-    // determined by a lexically-equivalent permutation (same character
-    // counts in different permutation).  Sum stored in candidate_count_b.
-    candidate_count_b += candidate_count_a;
-    int comparison_result = candidate_count_b.Compare(master_count);
-
-    if (!comparison_result) {
-      // This combination is a complete anagram; add it to the output,
-      // separating the partials by spaces.
-      string output_phrase = word;
-      output_phrase += " ";
-      output_phrase += i->first;
-      if (flags.output_directly) {
-        output_phrase.append("\n");
-        queue->Push(output_phrase.c_str());
+    sort(merged.begin(), merged.end(),
+      [](const pair< const string *, const string * >& a,
+         const pair< const string *, const string * >& b) {
+        return *a.first < *b.first;
+      });
+
+    // Group the words by the letters they leave of the master; the classes
+    // keep the alphabetical order of their first words
+    classes.clear();
+    keys.clear();
+    class_of.clear();
+    for (const auto& i : merged) {
+      int w = (int) next_word++;
+      partial_set.words[w] = *i.first;
+      auto found = class_of.find(*i.second);
+      if (class_of.end() == found) {
+        class_of[*i.second] = (int) classes.size();
+        classes.push_back(vector< int >(1, w));
+        keys.push_back(i.second);
       } else {
-        subset_lock.Acquire();
-        output[output_phrase] = 1;
-        subset_lock.Release();
-
-        if (!--output_queue_throttle) {
-          output_queue_throttle = kOutputQueueThrottleFrequency;
-          output_lock.Acquire();
-          static char out[256];
-          sprintf(out, "\rAnagrams found: %ld    ", output.size());
-          queue->Push(out);
-          output_lock.Release();
-        }
+        classes[found->second].push_back(w);
       }
-    } else if (comparison_result < 0) {
-      // The two candidates do not make a full anagram; Since the letter count
-      // permutation is still less than that of master, the two candidates
-      // combined still form a partial.  Below, we combine them in a space-
-      // delimited phrase and recurse.
-      string output_phrase = word;
-      output_phrase += " ";
-      output_phrase += i->first;
-      //OccupancyHash new_candidate_count;
-      //new_candidate_count.GetCharCountMap(output_phrase.c_str());
-      candidate_count_arr[depth]->clear();
-      candidate_count_arr[depth]->GetCharCountMap(output_phrase.c_str());
-      CombineSubsetsRecurseFast(
-        output_phrase.c_str(),
-        subset,
-        output,
-        master_count,
-        *candidate_count_arr[depth],
-        candidate_count_b,
-        candidate_count_arr,
-        i,
-        flags,
-        queue,
-        depth + 1
-      );
-    } else {
-      // The two candidates exceed the lexical permutative value of the
-      // master; this combination will not work so continue on...
     }
+
+    // Ahead of the shorter classes laid out before
+    size_t end = partial_set.first_class;
+    size_t first = end - classes.size();
+    for (size_t k = 0; k < classes.size(); ++k) {
+      size_t c = first + k;
+      partial_set.classes[c].swap(classes[k]);
+      partial_set.representatives[c] =
+        partial_set.words[partial_set.classes[c][0]];
+      partial_set.lengths[c] = length;
+      partial_set.signatures[length][*keys[k]] = (int) c;
+    }
+    for (size_t i = shorter + 1; i < length; ++i) {
+      partial_set.length_start[i] = end;
+    }
+    partial_set.length_start[length] = first;
+    partial_set.first_class = first;
+    shorter = length;
+    if (pipelined) {
+      QueueTaskRange(first, end, work_queue);
+    }
+  }
+  for (size_t i = shorter + 1; i <= master_length; ++i) {
+    partial_set.length_start[i] = partial_set.first_class;
+  }
+
+  // If we are to print subsets, this does that now, in alphabetical order
+  // (a resumed search printed them the first time).
+  if (flags.print_subset && !(checkpoint && checkpoint->Resumed())) {
+    vector< string > subset(partial_set.words);
+    sort(subset.begin(), subset.end());
+    PrintSubset(subset, queue);
   }
 }
 
-// CombineSubsetsFast
-// Given an input of a master word/phrase, find all combinations of partial words
-// to create complete anagrams.  Spaces in master word are ignored.
-// Entry: master word/phrase
-//        subset map of partials
-//        output map
-void CombineSubsetsFast(
-  const char *word,
-  std::map< std::string, int >& subset,
-  std::map< std::string, int >& output,
-  AnagramFlags flags,
-  int thread_index,
+// ReportTier
+// Logs the completion of one pass of fewest-words-first search (-f).
+// Entry: # of words per anagram in the pass
+//        search budget (for the time)
+void ReportTier(size_t tier, SearchBudget *budget)
+{
+  VERBOSE_LOG(LOG_INFO, "\r" << tier << "-word anagrams done after "
+    << budget->GetElapsedMs() << " ms" << std::endl);
+}
+
+// PrintTier
+// Prints the anagrams a pass of -f has merged onto the list, so that each
+// pass is listed as it completes even without -o.  Called by thread 0 while
+// the other threads wait for the next pass.
+// Entry: list of anagrams
+//        # of them printed so far (updated)
+//        output queue, drained first so that progress lines come before
+void PrintTier(
+  const std::vector< std::string >& anagrams,
+  size_t *printed,
   OutputQueue *queue
 )
 {
-  OccupancyHash master_count, candidate_count_a, candidate_count_b;
-  OccupancyHash *candidate_count_arr[64];
-  for (auto & i : candidate_count_arr) {
-    i = new OccupancyHash();
+  queue->AcquireLock();
+  queue->Sync();
+  if (*printed < anagrams.size()) {
+    VERBOSE_LOG(LOG_NORMAL, "\r                         \r");
   }
-
-  master_count.GetCharCountMap(word);
-  std::map<std::string, int>::const_iterator i = subset.begin();
-  for (auto inc = 0; inc < thread_index; ++inc) {
-    if( i != subset.end())
-      ++i;
-  }
-  // We want to interleave the processing, so
-  // we will start at a staggered position depending on our
-  // thread index.
-  while (i != subset.end()) {
-    if (!flags.allow_dupes && !strcmp(i->first.c_str(), word))
-      continue;
-    candidate_count_a.clear();
-    candidate_count_a.GetCharCountMap(i->first.c_str()); // count char occurrences
-
-    // Here we want to get a starting point for our character count
-    // for the candidate, and compare it against the others.
-    CombineSubsetsRecurseFast(
-        i->first.c_str(),
-        subset,
-        output,
-        master_count,
-        candidate_count_a,
-        candidate_count_b,
-        candidate_count_arr,
-        i,
-        flags,
-        queue,
-        0
-    );
-    // Increment by cpu count to preserve the task interleaving
-    for (size_t inc = 0; inc < cpu_tot; ++inc) {
-      if (i != subset.end()) { ++i; }
-    }
-  }
-
-  // Clean up
-  for (auto & di : candidate_count_arr) {
-    delete di;
+  for (; *printed < anagrams.size(); ++*printed) {
+    std::cout << anagrams[*printed] << '\n';
   }
+  std::cout.flush();
+  queue->ReleaseLock();
 }
 
 // GetAnagrams
-// Entry: pointer to ternary_tree
+// Entry: dictionary index
 //        word to check for anagrams
+//        list to merge the anagrams onto (unless -o or --count)
+//        result shards, one per thread
+// Hash is the histogram type chosen for this query (see
+// NeedsWideOccupancyHash); it is used for every count in the search.
+template <class Hash>
 void GetAnagrams(
-  TernaryTree& t,
-  TNode *root_node,
+  const DictionaryIndex& dictionary_index,
   const char *word,
-  std::map< std::string, int >& anagrams,
-  std::map< std::string, int >& subset,
-  std::map< std::string, int >& excludeset,
+  std::vector< std::string >& anagrams,
+  ResultShards *shards,
+  size_t *anagram_count,
+  std::vector< GatheredPartials >& gathered,
+  PartialSet& partial_set,
+  LetterIndex& letter_index,
+  const std::vector< uint64_t >& excluded,
   AnagramFlags flags,
   int thread_index,
+  WorkStealingQueue *work_queue,
+  MemoTable *memo,
+  SearchBudget *budget,
+  pthread_barrier_t *step_barrier,
   OutputQueue *queue
 )
 {
   using namespace std;
+  const SearchLimits& limits = budget->GetLimits();
+  typedef typename Hash::alphabet_type Alphabet;
   // Match lexical permutations:
   // We are going to try to find words containing ALL of the letters.
-  // We will generate starting with each letter and filter out the ones that
-  // have too many.
-
-  if (thread_index == 0) {
-    gather_lock.Acquire();  // block other threads until this first bit is done
-    size_t word_len = strlen((const char *)word);
-    map< int, string > extrapolation;
-
-    // Step 1: At the end of this process we will have a list of
-    // A) complete set of one-word complete anagrams, for example:
-    //  "live" -> "evil", "levi", "veil", "vile";
-    // B) full words representing potential parts of anagrams.
-    // Note that this first porion is single-threaded.
-    VERBOSE_LOG(LOG_DEBUG, "Step 1: Garner full-word anagrams and partials..." << endl);
-
-    // Get unique character counts for the master word/phrase
-    OccupancyHash master_count(word);
-    OccupancyHash candidate_count;  // reused for each candidate word
-
-    // Step through all the letters in the source word/phrase, avoiding repetitions.
-    // For example, if the phrase is "pussy cat":
-    // - find all words beginning with "p" and matching the character count,
-    //    and mark "p" as done.
-    //      o this will return phrases like
-    for (size_t i = 0; i <= word_len; ++i) {
-      char c[2] = {0,0};
-      *c = word[i];
-
-      if (chars_completed[(size_t)(unsigned char)c[0]]) {  // don't repeat letters already done
+  // The dictionary index gives us every word with no letter the master
+  // lacks and none more often than the master has it.
+  size_t master_length = LetterCount< Alphabet >(word);
+  Hash master_count(word);
+  vector< string >& shard = shards->GetShard(thread_index);
+
+  // Step 1: At the end of this process we will have a list of
+  // A) complete set of one-word complete anagrams, for example:
+  //  "live" -> "evil", "levi", "veil", "vile";
+  // B) full words representing potential parts of anagrams.
+  // Each thread gathers from its own part of the dictionary; thread 0 lays
+  // the parts out as the partial set, a length at a time, as the threads
+  // finish signing them.  Unless the search is pipelined, it waits for
+  // all of them.
+  VERBOSE_LOG(LOG_DEBUG, "Step 1: Garner full-word anagrams and partials..." << endl);
+  bool pipelined = PipelinesGathering(flags);
+  {
+    GatheredPartials& mine = gathered[thread_index];
+    Hash candidate_count;  // reused for each candidate word
+    NodeMeter meter(budget);  // candidates count against the budget too
+    string key;
+
+    vector< size_t > fitting;
+    dictionary_index.FindFitting< Alphabet >(word, excluded, &fitting,
+      thread_index, gathered.size());
+    SearchTask gather_task = { -1, thread_index };
+    BeginCheckpointTask(gather_task);
+
+    // A word that fits and has as many letters as the master is one of its
+    // anagrams; any shorter one is a partial.
+    mine.ids.resize(master_length);
+    for (size_t id : fitting) {
+      if (!meter.Visit())
+        break;
+      const string& candidate = dictionary_index.GetWord(id);
+
+      // This checks the word length limits, if any.
+      size_t length = LetterCount< Alphabet >(candidate.c_str());
+      if (length < limits.min_word_length ||
+          (limits.max_word_length && length > limits.max_word_length))
         continue;
-      }
-
-      chars_completed[(size_t)(unsigned char)c[0]] = 1;
 
-      extrapolation.clear();
-      t.FuzzyFind((const char *)c, root_node, &extrapolation);
-
-      // Now we'll check the lengths of each word and compare it to our input
-      // For the few that match, we'll check and see if they have the same
-      // characters.
-      for (const auto& it : extrapolation) {
-        // This checks if the word is in the exclude set; if so, ignore and continue.
-        if (excludeset.end() != excludeset.find(it.second))
+      if (length == master_length) {
+        // If we got here, it's a FULL anagram; add it.  Of the shards of
+        // a search, the first has these.
+        if (shard_index) {
           continue;
-
-        const char *candidate = it.second.c_str();
-
-        candidate_count.clear();
-        candidate_count.GetCharCountMap(candidate);
-
-        int comparison_result = candidate_count.Compare(master_count);
-        if (!comparison_result) { // candidate unique char counts == master?
-          // If we got here, it's a FULL anagram; add it.
-          if (!anagrams.count(candidate)) {
-            if (flags.output_directly) {
-              string out = candidate;
-              out += "\n";
-              queue->Push(out.c_str());
-            } else {
-              anagrams[candidate] = 1;
-              static char out[256];
-              sprintf(out, "\rAnagrams found: %ld    ", anagrams.size());
-              queue->Push(out);
-            }
-          }
-        }
-        else if (candidate_count.IsSubset(master_count)) { // candidate char counts < master?
-          subset[candidate] = 1;    // mark word as a partial
+        } else if (flags.count_only) {
+          budget->NoteResult();
+          __sync_fetch_and_add(anagram_count, 1);
+        } else {
+          string phrase;
+          StartPhrase(&phrase);
+          phrase += candidate;
+          EmitAnagram(phrase, shard, flags, queue);
         }
+      } else {
+        mine.ids[length].push_back(id);
       }
     }
-
-    // If we are to print subsets, this does that now.
-    if (flags.print_subset) {
-      PrintSubset(subset,queue);
+    EndCheckpointTask(meter, queue);
+    mine.signatures.resize(master_length);
+    __sync_synchronize();
+    mine.bucketed = true;
+
+    // Sign the partials shortest first, noting each length as it is done
+    for (size_t length = 1; length < master_length; ++length) {
+      for (size_t id : mine.ids[length]) {
+        candidate_count.clear();
+        candidate_count.GetCharCountMap(dictionary_index.GetWord(id).c_str());
+        key.clear();
+        master_count.PackSubset(candidate_count, &key);
+        mine.signatures[length].push_back(key);
+      }
+      __sync_synchronize();
+      mine.signed_length = length;
     }
+  }
 
-    gather_lock.Release();
-
-  } else {
-    // Non-first threads will block on this until the gathering
-    // process is complete
-    gather_lock.Acquire();
-    gather_lock.Release();
+  if (thread_index == 0) {
+    LayOutPartials(dictionary_index, gathered, master_length, partial_set,
+      flags, work_queue, queue);
+    VERBOSE_LOG(LOG_INFO, "Partials: " << partial_set.words.size()
+      << " in " << partial_set.classes.size() - partial_set.first_class
+      << " classes, after " << budget->GetElapsedMs() << " ms" << endl);
+    if (pipelined) {
+      work_queue->Done();   // every task is queued (see RunJob)
+    } else {
+      if (flags.rarest_first) {
+        BuildLetterIndex(master_count, partial_set, &letter_index);
+      }
+      if (!flags.fewest_first) {
+        QueueFirstClasses(partial_set, letter_index, flags, work_queue);
+      }
+    }
+  }
+  // Unless the search is pipelined, every thread waits here until the
+  // partial set is ready
+  if (!pipelined) {
+    pthread_barrier_wait(step_barrier);
   }
 
   // Iterates through all the findings and spit them out
@@ -497,9 +2113,77 @@ void GetAnagrams(
 
   // Step 2: Now we have a complete set of subsets; we must now combine them to
   // obtain combinations matching the input word character count permutation.
-  CombineSubsetsFast(word, subset, anagrams, flags, thread_index, queue);
+  if (flags.count_only) {
+    CountSubsets<Hash>(word, partial_set, anagram_count, flags, thread_index,
+      work_queue, memo, budget);
+  } else if (flags.fewest_first) {
+    // Search one word count at a time, fewest first, so that the best
+    // anagrams come out first.  The threads meet at the barrier before each
+    // pass (so that thread 0 has queued its tasks) and after it (so that
+    // all of its anagrams are out).  The one-word anagrams came out while
+    // gathering.  Each pass is merged onto the list after the ones before
+    // and printed by thread 0.  Whether to go on to a pass is thread 0's
+    // call alone: the budget may be stopped by a signal at any time, and
+    // threads deciding apart would leave some waiting at the barrier.
+    size_t tier_tot = partial_set.min_length ?
+      partial_set.master_length / partial_set.min_length : 0;
+    if (budget->GetLimits().max_words) {
+      tier_tot = min(tier_tot, budget->GetLimits().max_words);
+    }
+    size_t printed = 0;   // thread 0's
+    if (!flags.output_directly) {
+      shards->Merge(thread_index, step_barrier, &anagrams);
+    }
+    if (thread_index == 0) {
+      if (!flags.output_directly) {
+        PrintTier(anagrams, &printed, queue);
+      }
+      ReportTier(1, budget);
+    }
+    for (size_t tier = 2; tier <= tier_tot; ++tier) {
+      if (thread_index == 0) {
+        continue_tiers = !budget->Expired();
+        if (continue_tiers) {
+          QueueFirstClasses(partial_set, letter_index, flags, work_queue);
+        }
+      }
+      pthread_barrier_wait(step_barrier);
+      if (!continue_tiers) {
+        break;
+      }
+      if (flags.rarest_first) {
+        CombineSubsetsRarest<Hash>(word, partial_set, letter_index, shard,
+          flags, thread_index, work_queue, budget, tier, queue);
+      } else {
+        CombineSubsetsFast<Hash>(word, partial_set, shard, flags,
+          thread_index, work_queue, memo, budget, tier, queue);
+      }
+      if (flags.output_directly) {
+        pthread_barrier_wait(step_barrier);
+      } else {
+        shards->Merge(thread_index, step_barrier, &anagrams);
+      }
+      if (thread_index == 0) {
+        if (!flags.output_directly) {
+          PrintTier(anagrams, &printed, queue);
+        }
+        ReportTier(tier, budget);
+      }
+    }
+  } else {
+    if (flags.rarest_first) {
+      CombineSubsetsRarest<Hash>(word, partial_set, letter_index, shard,
+        flags, thread_index, work_queue, budget, 0, queue);
+    } else {
+      CombineSubsetsFast<Hash>(word, partial_set, shard, flags, thread_index,
+        work_queue, memo, budget, 0, queue);
+    }
+    if (!flags.output_directly) {
+      shards->Merge(thread_index, step_barrier, &anagrams);
+    }
+  }
 
-  OccupancyHash::PrintConstructorCalls();
+  Hash::PrintConstructorCalls();
 }
 
 //
@@ -509,21 +2193,77 @@ void GetAnagrams(
 // Global count of active threads.  Each thread decrements this on completion.
 static volatile int thread_total = 0;
 
+// How often the main thread looks to save the checkpoint while the search
+// threads run
+const long kCheckpointPollMs = 100;
+
+// The search threads wait to be let go until all of them have been created;
+// if one cannot be, those that were are let go to exit instead, before they
+// reach the step barrier (sized for them all).
+static volatile bool threads_go = false;
+static volatile bool threads_aborted = false;
+
 // AnagramWorkerParams
 // Structure for paramters to be passed to worker threads.
 // TODO: Move this to an appropriate header.
 struct AnagramWorkerParams {
-  TernaryTree *trie;
-  TNode *root_node;
+  const DictionaryIndex *dictionary_index;
   const char *word;
-  std::map< std::string, int > *anagrams;
-  std::map< std::string, int > *subset;
-  std::map< std::string, int > *excludeset;
+  std::vector< std::string > *anagrams;
+  ResultShards *shards;     // one per thread, merged onto anagrams
+  size_t *anagram_count;    // for --count
+  std::vector< GatheredPartials > *gathered;   // one per thread
+  PartialSet *partial_set;
+  LetterIndex *letter_index;
+  const std::vector< uint64_t > *excluded;   // word set (-e)
   AnagramFlags flags;
   int thread_index;
+  WorkStealingQueue *work_queue;
+  MemoTable *memo;
+  size_t memo_limit;   // memo table byte limit (-m)
+  SearchBudget *budget;   // search limits and budget
+  pthread_barrier_t *step_barrier;   // between steps and passes of -f
   OutputQueue *queue;
 };
 
+// GetAnagramsFn
+// Signature shared by the GetAnagrams instantiations.
+typedef void (*GetAnagramsFn)(
+  const DictionaryIndex&,
+  const char *,
+  std::vector< std::string >&,
+  ResultShards *,
+  size_t *,
+  std::vector< GatheredPartials >&,
+  PartialSet&,
+  LetterIndex&,
+  const std::vector< uint64_t >&,
+  AnagramFlags,
+  int,
+  WorkStealingQueue *,
+  MemoTable *,
+  SearchBudget *,
+  pthread_barrier_t *,
+  OutputQueue *);
+
+// SelectGetAnagrams
+// The histogram backend and width are chosen once per query; long phrases
+// get 16-bit counts, everything else the compact 8-bit ones.
+// Entry: flags
+// Exit: GetAnagrams for the alphabet, backend and width of the query
+template <class Alphabet>
+GetAnagramsFn SelectGetAnagrams(AnagramFlags flags)
+{
+  if (ENGINE_DENSE == flags.engine) {
+    if (flags.wide_histogram)
+      return &GetAnagrams< DenseOccupancyHash<Alphabet, unsigned short> >;
+    return &GetAnagrams< DenseOccupancyHash<Alphabet, unsigned char> >;
+  }
+  if (flags.wide_histogram)
+    return &GetAnagrams< WideOccupancyHash<Alphabet> >;
+  return &GetAnagrams< OccupancyHash<Alphabet> >;
+}
+
 // Worker
 // This is the top-level entry for job concurrent job processing.
 // Entry: AnagramWorkParams
@@ -531,66 +2271,113 @@ struct AnagramWorkerParams {
 void *Worker(void *worker_params)
 {
   auto *params = (AnagramWorkerParams *) worker_params;
+  while (!threads_go) {
+    sched_yield();
+  }
+  if (threads_aborted) {
+    __sync_fetch_and_sub(&thread_total, 1);
+    return nullptr;
+  }
 
-  GetAnagrams(
-    *params->trie,
-    params->root_node,
+  GetAnagramsFn get_anagrams;
+  switch (params->flags.alphabet) {
+    case ALPHABET_ENGLISH:
+      get_anagrams = SelectGetAnagrams<EnglishAlphabet>(params->flags);
+      break;
+    case ALPHABET_UTF8:
+      get_anagrams = SelectGetAnagrams<Utf8Alphabet>(params->flags);
+      break;
+    default:
+      get_anagrams = SelectGetAnagrams<Latin1Alphabet>(params->flags);
+      break;
+  }
+  get_anagrams(
+    *params->dictionary_index,
     params->word,
     *params->anagrams,
-    *params->subset,
-    *params->excludeset,
+    params->shards,
+    params->anagram_count,
+    *params->gathered,
+    *params->partial_set,
+    *params->letter_index,
+    *params->excluded,
     params->flags,
     params->thread_index,
+    params->work_queue,
+    params->memo,
+    params->budget,
+    params->step_barrier,
     params->queue
   );
 
   usleep(10000);
 
-  if (thread_total)
-    --thread_total;
+  __sync_fetch_and_sub(&thread_total, 1);
 
   return nullptr;
 }
 
-// initThreads
-//
-void RunJob(const unsigned int thread_tot, AnagramWorkerParams *params)
+// RunJob
+// Runs the search on the threads and waits for them to finish.
+// Entry: # of threads
+//        parameters common to them all
+// Exit: false == the threads could not be set up or started
+bool RunJob(const unsigned int thread_tot, AnagramWorkerParams *params)
 {
   // Our one and only output queue runs on its own thread
   OutputQueue queue;
 
-  // Clean the common chars_completed array shared by
-  // all the threads.
-  memset(chars_completed, 0, sizeof(chars_completed));
-
-  cpu_tot = thread_tot; // assume 1-to-1 correlation between threads and cpus
-
   // Allocate thread parameter blocks
   auto *thread_params =
     (AnagramWorkerParams *) malloc(sizeof(AnagramWorkerParams) * thread_tot);
   if (thread_params) {
   } else {
     VERBOSE_LOG(LOG_NONE, "Allocation error(1)" << std::endl);
-    return;
+    return false;
   }
 
   auto *pthread_struct = (pthread_t *) malloc(thread_tot * sizeof(pthread_t));
   if (!pthread_struct) {
     free(thread_params);
     VERBOSE_LOG(LOG_NONE, "Allocation error(2)" << std::endl);
-    return;
+    return false;
   }
 
   // This needs to be common to all the threads but does not
   // need to be visible to the client, so we will assume owneship
   // here.
-  std::map< std::string, int > subset;
+  std::vector< GatheredPartials > gathered(thread_tot);
+  ResultShards shards(thread_tot);
+  PartialSet partial_set;
+  LetterIndex letter_index;
+  WorkStealingQueue work_queue(thread_tot);
+  std::unique_ptr< MemoTable > memo;
+  if (params->flags.memoize || params->flags.count_only) {
+    memo.reset(new MemoTable(params->memo_limit));
+  }
+  pthread_barrier_t step_barrier;
+  pthread_barrier_init(&step_barrier, nullptr, thread_tot);
+  result_budget = params->budget;
+  // A pipelined search starts taking tasks before thread 0 has queued them
+  // all; the work is held open until it has
+  if (PipelinesGathering(params->flags)) {
+    work_queue.Hold();
+  }
+
   // This adds all the threads
   int error;
-  for (auto i = 0; i < thread_tot; ++i) {
+  unsigned int created = 0;
+  threads_go = threads_aborted = false;
+  for (unsigned int i = 0; i < thread_tot; ++i) {
     memcpy(thread_params + i, params, sizeof(AnagramWorkerParams));
     thread_params[i].thread_index = i;  // set cpu index
-    thread_params[i].subset = &subset;  // set the common working set
+    thread_params[i].gathered = &gathered;  // set the common working set
+    thread_params[i].shards = &shards;
+    thread_params[i].partial_set = &partial_set;
+    thread_params[i].letter_index = &letter_index;
+    thread_params[i].work_queue = &work_queue;
+    thread_params[i].memo = memo.get();
+    thread_params[i].step_barrier = &step_barrier;
     thread_params[i].queue = &queue;  // set the common working set
     error = pthread_create(
       &pthread_struct[i],
@@ -598,34 +2385,111 @@ void RunJob(const unsigned int thread_tot, AnagramWorkerParams *params)
       &Worker,
       (void *)(thread_params + i));
     if (error) {
-      // TODO: This is highly problematic if some threads were created!
-      // Want to look at pthread_cancel with cleanup handlers.
       VERBOSE_LOG(LOG_NONE, "Thread creation error" << std::endl);
-      free(thread_params);
-      return;
-    }
-    // Wait a few milliseconds to allow first thread to get in
-    if (!i) {
-      struct timespec ts = {0, 10000000L };
-      nanosleep(&ts, nullptr);
+      threads_aborted = true;
+      break;
     }
-
     ++thread_total;
+    ++created;
   }
+  threads_go = true;
 
-  // Twiddle our thumbs while threads do their thing
+  // Twiddle our thumbs while threads do their thing.  With a checkpoint,
+  // save on a timer meanwhile: one task may run for hours.
+  if (checkpoint) {
+    while (thread_total) {
+      struct timespec ts = { 0, kCheckpointPollMs * 1000000L };
+      nanosleep(&ts, nullptr);
+      checkpoint->SaveIfDue(&queue);
+    }
+  }
   void *result;
-  pthread_join(pthread_struct[0],&result);
-  pthread_join(pthread_struct[1],&result);
-  pthread_join(pthread_struct[2],&result);
-  pthread_join(pthread_struct[3],&result);
-  pthread_join(pthread_struct[4],&result);
-  pthread_join(pthread_struct[5],&result);
-  pthread_join(pthread_struct[6],&result);
+  for (unsigned int i = 0; i < created; ++i) {
+    pthread_join(pthread_struct[i], &result);
+  }
+  if (threads_aborted) {
+    pthread_barrier_destroy(&step_barrier);
+    free(pthread_struct);
+    free(thread_params);
+    return false;
+  }
+
+  // A search stopped part way saves where it got to; one that ran to the
+  // end has no more need of its checkpoint
+  if (checkpoint) {
+    if (params->budget->Expired()) {
+      checkpoint->Save(&queue);
+    } else {
+      checkpoint->Remove();
+    }
+  }
+  if (memo) {
+    memo->PrintStats();
+  }
+  VERBOSE_LOG(LOG_INFO, "Search nodes: " << params->budget->GetNodes()
+    << std::endl);
+  if (!params->flags.count_only) {
+    VERBOSE_LOG(LOG_INFO, "Search allocations: "
+      << params->budget->GetAllocations() << std::endl);
+  }
+  pthread_barrier_destroy(&step_barrier);
 
   // Clean up and get out
   free(pthread_struct);
   free(thread_params);
+  return true;
+}
+// SearchThreadCount
+// Exit: # of threads to search with
+unsigned SearchThreadCount()
+{
+  unsigned core_tot = std::thread::hardware_concurrency();
+  if (core_tot > 1) {
+    // Don't use ALL the cores; use cores - 1
+    core_tot -= 1;
+  } else {
+    core_tot = 1;
+  }
+  return core_tot;
+}
+
+// ExportClasses
+// Writes every anagram class of the dictionary to a file (--classes).
+// Entry: dictionary index (need not be built)
+//        # of threads
+//        path of file
+// Exit: 0 == success
+int ExportClasses(
+  const DictionaryIndex& dictionary_index,
+  unsigned thread_tot,
+  const std::string& path
+)
+{
+  using namespace std;
+  SearchLimits limits;
+  memset(&limits, 0, sizeof(limits));
+  SearchBudget budget(limits);   // for the timing only
+  vector< string > classes;
+  ClassExport class_export(dictionary_index, thread_tot);
+  bool done = class_export.Run(&classes);
+  ofstream file(path.c_str());
+  if (done && file) {
+    for (const auto& i : classes) {
+      file << i << '\n';
+    }
+    file.close();
+  }
+  if (!done || !file) {
+    VERBOSE_LOG(LOG_NONE, COUT_NORMAL_WHITE << "Could not write "
+      << path << "." << COUT_SHOWCURSOR << endl);
+    return -1;
+  }
+  VERBOSE_LOG(LOG_INFO, "Words left out: " << class_export.GetSkipped()
+    << endl);
+  VERBOSE_LOG(LOG_NORMAL, COUT_BOLD_WHITE << classes.size()
+    << " CLASSES WRITTEN in " << budget.GetElapsedMs() << " ms."
+    << COUT_NORMAL_WHITE << COUT_SHOWCURSOR << endl);
+  return 0;
 }
 } // namespace anagram
 
@@ -633,12 +2497,30 @@ void RunJob(const unsigned int thread_tot, AnagramWorkerParams *params)
 // Exception handling
 //
 
+// Default memo table size for -m
+const size_t kDefaultMemoLimit = 256 << 20;
+
+// Default # of completions for -c
+const size_t kDefaultCompleteTot = 10;
+
+// Default # of shards per worker for --workers, so that a worker that
+// finishes early can take on more
+const size_t kShardsPerWorker = 4;
+
+// Budget of the search under way, if any
+static anagram::SearchBudget *volatile active_budget = nullptr;
+
 // SigtermHandler
 // This is needed so that, if the user hits Ctrl-C, the curser
-// can be set back to normal.  It exits the program.
+// can be set back to normal.  The first Ctrl-C during a search stops it,
+// keeping what has been found so far; otherwise it exits the program.
 // Entry: signal type
 void SigtermHandler(int signal)
 {
+  if (active_budget && !active_budget->Expired()) {
+    active_budget->Stop();
+    return;
+  }
   std::cout << COUT_SHOWCURSOR << COUT_NORMAL_WHITE << std::endl;
   setvbuf(stdout, nullptr, _IONBF, 1024);  // TODO: Way to restore actual orig.?
   exit(1);
@@ -667,18 +2549,51 @@ int main(int argc, const char *argv[])
   sigemptyset(&sigIntHandler.sa_mask);
   sigIntHandler.sa_flags = 0;
   sigaction(SIGINT, &sigIntHandler, nullptr);
+  sigaction(SIGTERM, &sigIntHandler, nullptr);
 
   // Sets a sane level that allows UI but not debug messages
   SET_VERBOSITY_LEVEL(LOG_NORMAL);
 
+  // A resumed search (--resume) runs with the arguments it was started
+  // with, as saved in its checkpoint, in place of any given now.
+  unique_ptr< Checkpoint > saved_checkpoint;
+  vector< string > args(argv + 1, argv + argc);
+  vector< const char * > resumed_argv;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--resume=", 9))
+      continue;
+    saved_checkpoint.reset(new Checkpoint(argv[i] + 9));
+    if (!saved_checkpoint->Load(&args)) {
+      VERBOSE_LOG(LOG_NONE, "Cannot read checkpoint " << argv[i] + 9 << endl);
+      return -1;
+    }
+    resumed_argv.push_back(argv[0]);
+    for (const auto& arg : args) {
+      resumed_argv.push_back(arg.c_str());
+    }
+    argc = (int) resumed_argv.size();
+    argv = resumed_argv.data();
+    break;
+  }
+  string checkpoint_path;
+  string classes_path;      // --classes: export the dictionary's classes
+  string pattern_rack;      // letters the wildcards of -p may be
+  size_t complete_tot = kDefaultCompleteTot;
+  vector< string > worker_commands;   // --workers, --worker-cmd
+  size_t coordinated_shard_tot = 0;   // --shards
+
   // This parses the arguments and takes subsequent non-dashed arguments
   // as the input (no quotes required)
   AnagramFlags flags{};
   memset(&flags, 0, sizeof(flags));
-  flags.tree_engine = flags.allow_dupes = flags.output_directly
+  flags.engine = ENGINE_AUTO;
+  flags.allow_dupes = flags.output_directly
     = flags.big_dictionary = 0;
   string word;
-  map< string, int > excludeset;
+  vector< string > exclude_list, include_list;
+  size_t memo_limit = kDefaultMemoLimit;
+  SearchLimits limits;
+  memset(&limits, 0, sizeof(limits));
   if (1 < argc) {
     int i = 1;
     while (i < argc) {
@@ -696,17 +2611,40 @@ int main(int argc, const char *argv[])
               }
             }
             break;
+          case 'a': {
+              flags.sub_words = 1;
+              if ('s' == argv[i][2]) {
+                flags.rank_by_score = 1;
+              } else if (argv[i][2]) {
+                PrintUsage();
+                return -1;
+              }
+            }
+            break;
           case 'b': {
               flags.big_dictionary = 1;
             }
             break;
+          case 'c': {
+              flags.complete = 1;
+              if (isdigit(argv[i][2])) {
+                complete_tot = (size_t) atol(&argv[i][2]);
+              } else if (argv[i][2]) {
+                PrintUsage();
+                return -1;
+              }
+            }
+            break;
           case 'd': {
               flags.allow_dupes = 1;
             }
             break;
-           case 'e': {
-              // Parses out comma-separated lists of words to exclude, form:
-              // parse out -eword1,word2
+          case 'e':
+          case 'i': {
+              // Parses out comma-separated lists of words to exclude or
+              // include, form: -eword1,word2
+              vector< string >& list =
+                'e' == argv[i][1] ? exclude_list : include_list;
               string parse;
               int j = 0;
               const char *nchar = &argv[i][j + 2 - 1];
@@ -715,7 +2653,8 @@ int main(int argc, const char *argv[])
                 if (',' == *nchar || !(*nchar)) {
                   std::transform(parse.begin(), parse.end(), parse.begin(),
                     ::tolower);
-                  excludeset[parse] = 1;
+                  if (parse.length())
+                    list.push_back(parse);
                   parse = "";
                 } else {
                     parse += *nchar;
@@ -723,18 +2662,103 @@ int main(int argc, const char *argv[])
               } while (*nchar);
             }
             break;
+          case 'f': {
+             flags.fewest_first = 1;
+            }
+            break;
+          case 'g': {
+             flags.group_classes = 1;
+            }
+            break;
           case 's': {
              flags.print_subset = 1;
             }
             break;
+          case 'r': {
+             flags.rarest_first = 1;
+            }
+            break;
+          case 'p': {
+              flags.pattern = 1;
+              pattern_rack = &argv[i][2];
+              std::transform(pattern_rack.begin(), pattern_rack.end(),
+                pattern_rack.begin(), ::tolower);
+            }
+            break;
           case 't': {
-             flags.tree_engine = 1;
+              switch (argv[i][2]) {
+                case 's': flags.engine = ENGINE_SPARSE; break;
+                case 'd':
+                case '\0': flags.engine = ENGINE_DENSE; break;
+                default:
+                  PrintUsage();
+                  return -1;
+              }
             }
             break;
           case 'o': {
              flags.output_directly = 1;
             }
             break;
+          case 'm': {
+              flags.memoize = 1;
+              if (isdigit(argv[i][2])) {
+                memo_limit = (size_t) atol(&argv[i][2]) << 20;
+              }
+            }
+            break;
+          case '-': {
+              // Long options
+              if (!strcmp(argv[i], "--count")) {
+                flags.count_only = 1;
+              } else if (!strncmp(argv[i], "--checkpoint=", 13) &&
+                  argv[i][13]) {
+                checkpoint_path = argv[i] + 13;
+              } else if (!strncmp(argv[i], "--classes=", 10) && argv[i][10]) {
+                classes_path = argv[i] + 10;
+              } else if (!strncmp(argv[i], "--shard=", 8)) {
+                char slash = 0;
+                if (3 != sscanf(argv[i] + 8, "%zu%c%zu", &shard_index, &slash,
+                      &shard_tot) || '/' != slash || shard_index >= shard_tot) {
+                  PrintUsage();
+                  return -1;
+                }
+              } else if (!strncmp(argv[i], "--shards=", 9) &&
+                  isdigit(argv[i][9])) {
+                coordinated_shard_tot = (size_t) atol(argv[i] + 9);
+              } else if (!strncmp(argv[i], "--workers=", 10) &&
+                  isdigit(argv[i][10])) {
+                worker_commands.insert(worker_commands.end(),
+                  (size_t) atol(argv[i] + 10), ShellQuote(argv[0]));
+              } else if (!strncmp(argv[i], "--worker-cmd=", 13) &&
+                  argv[i][13]) {
+                worker_commands.push_back(argv[i] + 13);
+              } else {
+                PrintUsage();
+                return -1;
+              }
+            }
+            break;
+          case 'w':
+          case 'l':
+          case 'L':
+          case 'T':
+          case 'N': {
+              // Search limits all take a number: -w3, -l2, -T500 etc.
+              if (!isdigit(argv[i][2])) {
+                PrintUsage();
+                return -1;
+              }
+              long value = atol(&argv[i][2]);
+              switch (argv[i][1]) {
+                case 'w': limits.max_words = (size_t) value; break;
+                case 'l': limits.min_word_length = (size_t) value; break;
+                case 'L': limits.max_word_length = (size_t) value; break;
+                case 'T': limits.time_limit_ms = value; break;
+                default: limits.node_limit = value; break;
+              }
+            }
+            break;
 
           default:
             PrintUsage();
@@ -756,11 +2780,93 @@ int main(int argc, const char *argv[])
     }).base(), word.end());
   std::transform(word.begin(), word.end(), word.begin(), ::tolower);
 
-  if (!word.length()) {
+  // Blanks (?) stand for any letter, and only make sense for -a; a
+  // pattern (-p) keeps its wildcards
+  size_t blank_tot = 0;
+  if (flags.sub_words + flags.pattern + flags.complete > 1) {
+    PrintUsage();
+    return -1;
+  } else if (!flags.pattern && !flags.complete) {
+    blank_tot = std::count(word.begin(), word.end(), '?');
+    if (blank_tot && !flags.sub_words) {
+      VERBOSE_LOG(LOG_NONE, "Blanks (?) only go with -a or -p." << endl);
+      return -1;
+    }
+    word.erase(std::remove(word.begin(), word.end(), '?'), word.end());
+  }
+
+  // A phrase is needed, except to complete from nothing (-c) and for
+  // --classes, which takes none
+  bool has_phrase = word.length() || blank_tot;
+  if (classes_path.empty() ? !has_phrase && !flags.complete : has_phrase) {
     PrintUsage();
     return -1;
   }
 
+
+  // Counting has a search of its own and never builds phrases
+  if (flags.count_only) {
+    flags.rarest_first = flags.group_classes = flags.output_directly = 0;
+    flags.fewest_first = 0;
+  }
+  // A search split into shards (--shard, or as coordinator --workers) is
+  // only the plain search, listed or counted
+  bool coordinating = !worker_commands.empty();
+  if ((coordinating || shard_tot || coordinated_shard_tot) &&
+      (coordinating == (0 != shard_tot) || flags.fewest_first ||
+       flags.print_subset || flags.sub_words || flags.pattern ||
+       flags.complete || !classes_path.empty() || saved_checkpoint ||
+       !checkpoint_path.empty())) {
+    VERBOSE_LOG(LOG_NONE, "--shard goes without --workers and --worker-cmd, "
+      "--shards with them, and none with -a, -c, -f, -p, -s, --checkpoint or "
+      "--classes." << endl);
+    return -1;
+  }
+  // Each shard would have the whole time or node budget to itself, and
+  // the shards run a few to a worker, so the limits are not passed on
+  if (coordinating && (limits.time_limit_ms || limits.node_limit)) {
+    VERBOSE_LOG(LOG_NONE, "-T and -N do not go with --workers or "
+      "--worker-cmd; give them to a single search or to each --shard."
+      << endl);
+    return -1;
+  }
+
+  // Neither do sub-words, patterns or completions, which are single
+  // dictionary words
+  bool word_lookup = flags.sub_words || flags.pattern || flags.complete;
+  if (word_lookup && (saved_checkpoint || !checkpoint_path.empty())) {
+    VERBOSE_LOG(LOG_NONE, "--checkpoint and --resume do not go with -a, -c "
+      "or -p." << endl);
+    return -1;
+  }
+
+  // A checkpoint follows the results written straight to a file, which a
+  // resumed search first cuts back to what the checkpoint accounts for.
+  if (saved_checkpoint || !checkpoint_path.empty()) {
+    struct stat output_stat;
+    if (!flags.output_directly || flags.fewest_first ||
+        fstat(STDOUT_FILENO, &output_stat) || !S_ISREG(output_stat.st_mode)) {
+      VERBOSE_LOG(LOG_NONE, "--checkpoint and --resume need -o with the "
+        "output redirected to a file, and do not go with -f or --count."
+        << endl);
+      return -1;
+    }
+    if (!saved_checkpoint) {
+      saved_checkpoint.reset(new Checkpoint(checkpoint_path));
+    }
+    checkpoint = saved_checkpoint.get();
+    if (checkpoint->Resumed()) {
+      off_t length = (off_t) checkpoint->GetOutputLength();
+      if (lseek(STDOUT_FILENO, 0, SEEK_END) < length ||
+          ftruncate(STDOUT_FILENO, length) ||
+          lseek(STDOUT_FILENO, length, SEEK_SET) < 0) {
+        VERBOSE_LOG(LOG_NONE, "The output is shorter than the checkpoint; "
+          "resume appending to it (>>)." << endl);
+        return -1;
+      }
+    }
+  }
+
   // This will hide the cursor and set the color
   if (!flags.output_directly) {
     VERBOSE_LOG(LOG_NORMAL, COUT_HIDECURSOR << COUT_BOLD_YELLOW << endl);
@@ -774,62 +2880,261 @@ int main(int argc, const char *argv[])
   setbuf(stdout, nullptr);
 
   // This reads the dictionary file and gathers all the anagrams
-  // from our source word.
+  // from our source word.  Only the trie lookups keep the lines.
+  bool needs_trie = flags.pattern || flags.complete;
+  DictionaryIndex dictionary_index;
+  vector< vector< string > > dictionary_files(flags.big_dictionary ? 2 : 1);
   ReadDictionaryFile(
     "anagram_dict_no_abbreviations.txt",
-    &trie,
-    root_node
+    needs_trie ? &dictionary_files[0] : nullptr,
+    &dictionary_index
   );
   if (flags.big_dictionary) {
     ReadDictionaryFile(
       "anagram_bigdict.txt",
-      &trie,
-      root_node
+      needs_trie ? &dictionary_files[1] : nullptr,
+      &dictionary_index
     );
   }
 
+  // Exporting the classes needs only the words
+  if (!classes_path.empty()) {
+    return ExportClasses(dictionary_index, SearchThreadCount(), classes_path);
+  }
+
+  // Pick the alphabet and histogram width for this query.  The phrase may
+  // use letters no dictionary word does, so it is registered as well.
+  Utf8Alphabet::Register(word.c_str());
+  flags.alphabet = ChooseAlphabet(word.c_str());
+  flags.wide_histogram = NeedsWideOccupancyHash(word.c_str(),
+    (AlphabetId) flags.alphabet);
+  if (ENGINE_AUTO == flags.engine) {
+    flags.engine = ChooseHistogramEngine(word.c_str(),
+      (AlphabetId) flags.alphabet);
+  }
+  VERBOSE_LOG(LOG_INFO, "Histogram: "
+    << (ENGINE_DENSE == flags.engine ? "dense" : "sparse")
+    << (flags.wide_histogram ? ", 16-bit" : ", 8-bit") << std::endl);
+
+  // Bit-slice the dictionary's letter counts in the alphabet's lanes
+  switch (flags.alphabet) {
+    case ALPHABET_ENGLISH:
+      dictionary_index.Build<EnglishAlphabet>();
+      break;
+    case ALPHABET_UTF8:
+      dictionary_index.Build<Utf8Alphabet>();
+      break;
+    default:
+      dictionary_index.Build<Latin1Alphabet>();
+      break;
+  }
+  VERBOSE_LOG(LOG_INFO, "Dictionary index: "
+    << dictionary_index.GetWordCount() << " words, "
+    << dictionary_index.GetSliceCount() << " slices" << std::endl);
+
+  // Included words (-i) are taken out of the phrase, so that only the rest
+  // of it is searched, and count toward the word limits.  Unless
+  // duplicates are allowed they may not be used again.
+  string search_word = word;
+  bool searchable = true;       // letters are left to search
+  bool included_alone = false;  // the included words are an anagram
+  if (!include_list.empty()) {
+    bool fits = false;
+    switch (flags.alphabet) {
+      case ALPHABET_ENGLISH:
+        fits = SubtractWords< EnglishAlphabet >(word, include_list,
+          &search_word);
+        break;
+      case ALPHABET_UTF8:
+        fits = SubtractWords< Utf8Alphabet >(word, include_list,
+          &search_word);
+        break;
+      default:
+        fits = SubtractWords< Latin1Alphabet >(word, include_list,
+          &search_word);
+        break;
+    }
+    if (!fits) {
+      VERBOSE_LOG(LOG_NONE, COUT_NORMAL_WHITE
+        << "The words to include are not in the phrase." << COUT_SHOWCURSOR
+        << endl);
+      return -1;
+    }
+    for (const auto& i : include_list) {
+      included_words += (included_words.empty() ? "" : " ") + i;
+    }
+    if (!flags.allow_dupes) {
+      exclude_list.insert(exclude_list.end(), include_list.begin(),
+        include_list.end());
+    }
+    size_t included = include_list.size();
+    bool rest_empty = string::npos == search_word.find_first_not_of(' ');
+    bool too_many = limits.max_words &&
+      limits.max_words < included + (rest_empty ? 0 : 1);
+    if (limits.max_words && !too_many)
+      limits.max_words -= included;
+    searchable = !rest_empty && !too_many;
+    included_alone = rest_empty && !too_many;
+  }
+  vector< uint64_t > excluded;
+  if (!exclude_list.empty()) {
+    dictionary_index.GetWordSet(exclude_list, &excluded);
+  }
+
   // Sets up our structure to hold the anagrams.  Note that, if
   // the -o "output_directly" flag is set, this will not be used and
   // the output will instead go directly to std::out, making
   // huge anagram files possible (> available physical memory).
-  map< string, int > anagrams;  // container for anagram strings
-  trie.SetMaxDifference(0);  // Do not clamp by Levenshtein distance
+  vector< string > anagrams;  // container for anagram strings
+  size_t anagram_count = 0;     // or just their number, for --count
+  int exit_code = 0;
 
   AnagramWorkerParams params{};
-  params.trie = &trie;
-  params.root_node = root_node;
-  params.word = word.c_str();
+  params.dictionary_index = &dictionary_index;
+  params.word = search_word.c_str();
   params.anagrams = &anagrams;
+  params.anagram_count = &anagram_count;
   params.flags = flags;
   params.thread_index = 0;   // Round-robined in RunJob
-  params.excludeset = &excludeset;   // Round-robined in RunJob
-
-  unsigned core_tot = std::thread::hardware_concurrency();
-  if (core_tot > 1) {
-    // Don't use ALL the cores; use cores - 1
-    core_tot -= 1;
-  } else {
-    core_tot = 1;
+  params.excluded = &excluded;
+  params.memo_limit = memo_limit;
+
+  unsigned core_tot = SearchThreadCount();
+  // The tasks, and a thread's part of the dictionary, depend on the
+  // # of threads, so a resumed search uses as many as before
+  if (checkpoint && checkpoint->Resumed()) {
+    core_tot = (unsigned) checkpoint->GetThreadTot();
+  } else if (checkpoint) {
+    checkpoint->SetQuery(args, core_tot);
+  }
+  SearchBudget budget(limits);   // starts the clock for -T
+  params.budget = &budget;
+  active_budget = &budget;
+
+  // Fewest words first (-f) prints each pass as it completes (see
+  // PrintTier), so the phrase goes ahead of them
+  bool print_tiers = flags.fewest_first && !flags.output_directly &&
+    searchable && !word_lookup;
+  if (print_tiers) {
+    VERBOSE_LOG(LOG_NORMAL, "\r                         \r"
+      << COUT_BOLD_WHITE << word.c_str()
+      << COUT_BOLD_YELLOW << endl);
+  }
+  if (needs_trie) {
+    // These are looked up on the trie itself
+    trie.SetMaxDifference(0);  // Do not clamp by Levenshtein distance
+    BuildTrie(&trie, &root_node, dictionary_files);
+    dictionary_files.clear();
+    long start_us = budget.GetElapsedUs();
+    if (flags.pattern) {
+      trie.PatternFind(word.c_str(), trie.GetRoot(),
+        pattern_rack.empty() ? nullptr : pattern_rack.c_str(), &anagrams);
+    } else {
+      trie.Complete(word.c_str(), trie.GetRoot(), complete_tot, &anagrams);
+    }
+    VERBOSE_LOG(LOG_INFO, "Lookup: " << budget.GetElapsedUs() - start_us
+      << " us" << endl);
+  } else if (flags.sub_words) {
+    switch (flags.alphabet) {
+      case ALPHABET_ENGLISH:
+        ListSubWords< EnglishAlphabet >(dictionary_index, search_word.c_str(),
+          blank_tot, excluded, limits, flags, &anagrams);
+        break;
+      case ALPHABET_UTF8:
+        ListSubWords< Utf8Alphabet >(dictionary_index, search_word.c_str(),
+          blank_tot, excluded, limits, flags, &anagrams);
+        break;
+      default:
+        ListSubWords< Latin1Alphabet >(dictionary_index, search_word.c_str(),
+          blank_tot, excluded, limits, flags, &anagrams);
+        break;
+    }
+  }
+  if (word_lookup) {
+    anagram_count = anagrams.size();
+    if (flags.output_directly) {
+      for (const auto& i : anagrams) {
+        cout << i << '\n';
+      }
+      cout.flush();
+      anagrams.clear();
+    }
+  } else if (searchable && coordinating) {
+    // The workers are given the options of this search, less those that
+    // are the coordinator's, and the phrase
+    vector< string > options, phrase;
+    for (const auto& arg : args) {
+      if ('-' != arg[0] || !phrase.empty()) {
+        phrase.push_back(arg);
+      } else if (arg.compare(0, 10, "--workers=") &&
+          arg.compare(0, 13, "--worker-cmd=") &&
+          arg.compare(0, 9, "--shards=") && arg.compare(0, 2, "-v") &&
+          arg != "-o") {
+        options.push_back(arg);
+      }
+    }
+    size_t shards = coordinated_shard_tot ?
+      coordinated_shard_tot : worker_commands.size() * kShardsPerWorker;
+    ShardCoordinator coordinator(worker_commands, shards, options, phrase);
+    if (!coordinator.Run(flags.count_only, flags.output_directly, &anagrams,
+          &anagram_count)) {
+      VERBOSE_LOG(LOG_NONE, COUT_NORMAL_WHITE << "Not every shard completed; "
+        "the results are partial." << endl);
+      exit_code = -1;
+    }
+    if (!flags.output_directly) {
+      sort(anagrams.begin(), anagrams.end());
+      anagrams.erase(unique(anagrams.begin(), anagrams.end()),
+        anagrams.end());
+    }
+  } else if (searchable) {
+    if (!RunJob(core_tot, &params)) {
+      exit_code = -1;
+    }
+  } else if (included_alone && !shard_index) {
+    ++anagram_count;
+    if (flags.output_directly) {
+      cout << included_words << endl;
+    } else {
+      anagrams.push_back(included_words);
+    }
   }
-  RunJob(core_tot, &params);
+  active_budget = nullptr;
 
   // Iterates through all the findings and spit them out to stdout.
   // Only does so if we are not outputting directly; otherwise the
   // output collection will be empty.
-  if (!flags.output_directly) {
-    VERBOSE_LOG(LOG_NORMAL, "\r                         \r"
-      << COUT_BOLD_WHITE << word.c_str()
+  if (flags.count_only) {
+    VERBOSE_LOG(LOG_NORMAL, COUT_BOLD_WHITE << word.c_str()
       << COUT_BOLD_YELLOW << endl);
-    int count = 0;
-    for (const auto& i : anagrams) {
-      cout << i.first << endl;
-      ++count;
+    cout << anagram_count << endl;
+  } else if (!flags.output_directly) {
+    size_t count = anagrams.size();
+    if (!print_tiers) {
+      VERBOSE_LOG(LOG_NORMAL, "\r                         \r"
+        << COUT_BOLD_WHITE << word.c_str()
+        << COUT_BOLD_YELLOW << endl);
+      for (const auto& i : anagrams) {
+        cout << i << endl;
+      }
     }
-    VERBOSE_LOG(LOG_NORMAL,  COUT_BOLD_WHITE << count << " ANAGRAMS FOUND.");
+    VERBOSE_LOG(LOG_NORMAL,  COUT_BOLD_WHITE << count
+      << (word_lookup ? " WORDS FOUND." : " ANAGRAMS FOUND."));
+  }
+  if (budget.Expired()) {
+    VERBOSE_LOG(LOG_NORMAL, endl << COUT_BOLD_YELLOW
+      << "Search stopped early; results are partial.");
+  }
+  if (budget.GetFirstResultMs() >= 0) {
+    int level = flags.fewest_first ? LOG_NORMAL : LOG_INFO;
+    VERBOSE_LOG(level, endl
+      << COUT_NORMAL_WHITE << "First result after "
+      << budget.GetFirstResultMs() << " ms");
+  }
+  if (!shard_tot) {   // a worker's output is only its results
+    VERBOSE_LOG(LOG_NONE, COUT_NORMAL_WHITE << COUT_SHOWCURSOR << endl);
   }
-  VERBOSE_LOG(LOG_NONE, COUT_NORMAL_WHITE << COUT_SHOWCURSOR << endl);
-
   setvbuf(stdout, nullptr, _IONBF, 1024);  // TODO: Way to restore actual orig.?
-  return 0;
+  return exit_code;
 }
 #pragma clang diagnostic pop
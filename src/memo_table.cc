@@ -0,0 +1,114 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <iostream>
+#include <functional>
+
+#include "memo_table.h"
+#include "anagram_log.h"
+
+namespace anagram {
+
+// Constructor
+// Entry: total # of bytes the table may hold
+MemoTable::MemoTable(size_t byte_limit)
+{
+  shards_ = new Shard[kShardTot];
+  for (size_t i = 0; i < kShardTot; ++i) {
+    shards_[i].bytes = 0;
+  }
+  shard_limit_ = byte_limit / kShardTot;
+  hits_ = misses_ = evictions_ = 0;
+}
+
+// Destructor
+MemoTable::~MemoTable()
+{
+  delete [] shards_;
+}
+
+// EntryBytes
+// Approximate memory held by an entry, including the key and map overhead.
+size_t MemoTable::EntryBytes(const std::string& key, const MemoEntry& entry)
+{
+  return 2 * key.size() + sizeof(MemoSolutions) + 64 +
+    entry->words.capacity() * sizeof(int);
+}
+
+// Find
+// Entry: key
+// Exit: cached entry, or an empty pointer if none
+MemoEntry MemoTable::Find(const std::string& key)
+{
+  Shard& shard = shards_[std::hash< std::string >()(key) % kShardTot];
+  MemoEntry entry;
+  shard.lock.Acquire();
+  auto it = shard.entries.find(key);
+  if (shard.entries.end() != it)
+    entry = it->second;
+  shard.lock.Release();
+  __sync_fetch_and_add(entry ? &hits_ : &misses_, 1);
+  return entry;
+}
+
+// Insert
+// Caches an entry, evicting the shard's oldest entries if it is over its
+// share of the limit.  Entries larger than a quarter of a shard's share are
+// not cached; they would push out many smaller, cheaper-to-keep ones.
+// Entry: key
+//        entry
+void MemoTable::Insert(const std::string& key, const MemoEntry& entry)
+{
+  size_t bytes = EntryBytes(key, entry);
+  if (bytes > shard_limit_ / 4)
+    return;
+
+  Shard& shard = shards_[std::hash< std::string >()(key) % kShardTot];
+  shard.lock.Acquire();
+  if (shard.entries.insert(std::make_pair(key, entry)).second) {
+    shard.order.push_back(key);
+    shard.bytes += bytes;
+    while (shard.bytes > shard_limit_ && !shard.order.empty()) {
+      auto it = shard.entries.find(shard.order.front());
+      shard.bytes -= EntryBytes(it->first, it->second);
+      shard.entries.erase(it);
+      shard.order.pop_front();
+      __sync_fetch_and_add(&evictions_, 1);
+    }
+  }
+  shard.lock.Release();
+}
+
+// PrintStats
+void MemoTable::PrintStats()
+{
+  size_t entries = 0, bytes = 0;
+  for (size_t i = 0; i < kShardTot; ++i) {
+    entries += shards_[i].entries.size();
+    bytes += shards_[i].bytes;
+  }
+  VERBOSE_LOG(LOG_INFO, "Memo: " << hits_ << " hits, " << misses_
+    << " misses, " << evictions_ << " evictions, " << entries
+    << " entries, " << (bytes >> 10) << "KB" << std::endl);
+}
+} // namespace anagram
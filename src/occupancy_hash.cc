@@ -1,11 +1,62 @@
 #include "occupancy_hash.h"
+#include "anagram_flags.h"
 namespace anagram {
 
-int anagram::OccupancyHash::constructor_count_ = 0;
-void OccupancyHash::PrintConstructorCalls()
+// NeedsWideOccupancyHashFor
+// Determines whether a phrase overflows the narrow OccupancyHash, either by
+// having too many unique characters or too many of a single one.
+// Entry: phrase
+// Exit: true == use WideOccupancyHash for this query
+template <class Alphabet>
+static bool NeedsWideOccupancyHashFor(const char *phrase)
 {
-  VERBOSE_LOG(LOG_INFO, "Occupancy constructor calls: " << OccupancyHash::constructor_count_ << std::endl);
+  WideOccupancyHash<Alphabet> phrase_count(phrase);
+  return phrase_count.GetIndexPtr() >
+      OccupancyHash<Alphabet>::kMaxUniqueChars ||
+    phrase_count.GetMaxCharCount() > kNarrowMaxCharCount;
 }
 
+// NeedsWideOccupancyHash
+// Entry: phrase
+//        alphabet chosen for the query
+// Exit: true == use WideOccupancyHash for this query
+bool NeedsWideOccupancyHash(const char *phrase, AlphabetId alphabet)
+{
+  switch (alphabet) {
+    case ALPHABET_ENGLISH:
+      return NeedsWideOccupancyHashFor<EnglishAlphabet>(phrase);
+    case ALPHABET_UTF8:
+      return NeedsWideOccupancyHashFor<Utf8Alphabet>(phrase);
+    default:
+      return NeedsWideOccupancyHashFor<Latin1Alphabet>(phrase);
+  }
+}
+
+// ChooseHistogramEngine
+// Picks a backend when the user has not.  The dense hash scans every lane
+// of the alphabet, so it pays off when the alphabet is small (English fits
+// one vector register) or the phrase occupies a good share of its lanes;
+// otherwise the sparse hash, which only visits occupied characters, is
+// cheaper.
+// Entry: phrase
+//        alphabet chosen for the query
+// Exit: ENGINE_SPARSE or ENGINE_DENSE
+int ChooseHistogramEngine(const char *phrase, AlphabetId alphabet)
+{
+  size_t unique, lanes;
+  switch (alphabet) {
+    case ALPHABET_ENGLISH:
+      return ENGINE_DENSE;
+    case ALPHABET_UTF8:
+      unique = WideOccupancyHash<Utf8Alphabet>(phrase).GetIndexPtr();
+      lanes = Utf8Alphabet::PaddedLaneCount();
+      break;
+    default:
+      unique = WideOccupancyHash<Latin1Alphabet>(phrase).GetIndexPtr();
+      lanes = Latin1Alphabet::PaddedLaneCount();
+      break;
+  }
+  return unique * 4 >= lanes ? ENGINE_DENSE : ENGINE_SPARSE;
+}
 
 } // namespace anagram
@@ -21,6 +21,7 @@
  * SOFTWARE.
  */
 
+#include <cstdio>
 #include <iostream>
 #include <thread>    // TODO: Move to boost threads for OS independence
 #include <cstring>
@@ -121,16 +122,33 @@ const char *OutputQueue::Pop()
 }
 
 // Push
-// Remove the next item in FIFO order.
-// Exit: pointer to string, or nullptr if none.
-// NOTE: string length must be 256 or less.
-void OutputQueue::Push(const char *text)
+// Add an item to the end of the queue.  Text too long for a queue item is
+// written straight out instead, once the queue ahead of it is, so that the
+// output stays in order.
+// Entry: text
+//        count to add one to once the text is queued, under the queue lock
+//        (optional; see Checkpoint)
+void OutputQueue::Push(const char *text, size_t *pushed)
 {
-  // We will BLOCK if necessary until we can write to the queue.
+  // We will BLOCK if necessary until we can write to the queue.  The check
+  // for room is made under the lock; otherwise several threads could see the
+  // same free slot and overrun the queue.
+  queue_lock_.Acquire();  // Atomic operation - one at a time, so lock.
+  if (text && strlen(text) >= kOutputQueueItemSize) {
+    Sync();
+    std::cout << text;
+    std::cout.flush();
+    if (pushed) {
+      ++*pushed;
+    }
+    queue_lock_.Release();
+    return;
+  }
   while (GetItemTot() == queue_size_ - 1) {
+    queue_lock_.Release();
     sched_yield();
+    queue_lock_.Acquire();
   }
-  queue_lock_.Acquire();  // Atomic operation - one at a time, so lock.
 
   // Need to copy the text because the source may go out of scope
   // by the time the worker thread processes it.
@@ -143,10 +161,27 @@ void OutputQueue::Push(const char *text)
   if (++queue_start_index_ >= queue_size_) {
     queue_start_index_ = 0;
   }
+  if (pushed) {
+    ++*pushed;
+  }
 
   queue_lock_.Release();
 }
 
+// Sync
+// Writes out every item queued so far and flushes the stream, so that all
+// of them are in the output.
+// NOTE: the caller holds the queue lock (see AcquireLock).
+void OutputQueue::Sync()
+{
+  const char *output_string;
+  while (nullptr != (output_string = Pop())) {
+    std::cout << output_string;
+  }
+  std::cout.flush();
+  fflush(stdout);
+}
+
 // GetItemTot
 // Returns the # of items currently awaiting processing in the queue.
 // Exit: # of items in queue
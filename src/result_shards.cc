@@ -0,0 +1,159 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+#include "result_shards.h"
+
+namespace anagram {
+
+// Keys sampled from each shard per range when choosing the splitters
+const size_t kSamplesPerRange = 4;
+
+// Constructor
+// Entry: # of search threads (one shard and one merge range each)
+ResultShards::ResultShards(size_t thread_tot)
+{
+  thread_tot_ = thread_tot ? thread_tot : 1;
+  shards_.resize(thread_tot_);
+  parts_.resize(thread_tot_);
+}
+
+// Destructor
+ResultShards::~ResultShards()
+{
+}
+
+// Merge
+// Called by every search thread at once: merges all of the shards, sorted
+// and without duplicates, onto the end of the merged list, and empties
+// them.
+// Entry: index of the calling thread
+//        barrier for all of the search threads
+//        merged list to append to
+void ResultShards::Merge(
+  size_t thread_index,
+  pthread_barrier_t *barrier,
+  std::vector< std::string > *merged)
+{
+  std::sort(shards_[thread_index].begin(), shards_[thread_index].end());
+  pthread_barrier_wait(barrier);
+  if (thread_index == 0) {
+    ChooseSplitters();
+    FindRanges();
+  }
+  pthread_barrier_wait(barrier);
+  MergeRange(thread_index);
+  pthread_barrier_wait(barrier);
+  if (thread_index == 0) {
+    for (auto& part : parts_) {
+      merged->insert(merged->end(), std::make_move_iterator(part.begin()),
+        std::make_move_iterator(part.end()));
+      part.clear();
+    }
+    for (auto& shard : shards_) {
+      shard.clear();
+    }
+  }
+  pthread_barrier_wait(barrier);
+}
+
+// ChooseSplitters
+// Samples keys evenly from each sorted shard and takes every
+// kSamplesPerRange-th of them, in order, as the bounds between the ranges.
+void ResultShards::ChooseSplitters()
+{
+  std::vector< const std::string * > samples;
+  size_t per_shard = kSamplesPerRange * thread_tot_;
+  for (const auto& shard : shards_) {
+    if (shard.empty())
+      continue;
+    size_t step = std::max(shard.size() / per_shard, (size_t) 1);
+    for (size_t i = step / 2; i < shard.size(); i += step) {
+      samples.push_back(&shard[i]);
+    }
+  }
+  std::sort(samples.begin(), samples.end(),
+    [](const std::string *a, const std::string *b) { return *a < *b; });
+
+  splitters_.clear();
+  if (samples.empty())
+    return;
+  for (size_t range = 1; range < thread_tot_; ++range) {
+    splitters_.push_back(*samples[range * samples.size() / thread_tot_]);
+  }
+}
+
+// FindRanges
+// Finds where each range starts in each shard.  This is done before any
+// range is merged, since merging moves the keys out of the shards.
+void ResultShards::FindRanges()
+{
+  range_starts_.assign(thread_tot_ + 1,
+    std::vector< size_t >(thread_tot_, 0));
+  for (size_t i = 0; i < thread_tot_; ++i) {
+    const std::vector< std::string >& shard = shards_[i];
+    for (size_t range = 1; range <= thread_tot_; ++range) {
+      range_starts_[range][i] = range > splitters_.size() ? shard.size() :
+        std::lower_bound(shard.begin(), shard.end(), splitters_[range - 1])
+        - shard.begin();
+    }
+  }
+}
+
+// MergeRange
+// Merges one range of every shard into its part, moving the keys out of
+// the shards.  Equal keys always fall in the same range, so dropping the
+// ones equal to the last taken removes every duplicate.
+// Entry: range index
+void ResultShards::MergeRange(size_t range)
+{
+  typedef std::pair< size_t, size_t > Cursor;  // (shard, position)
+  auto later = [this](const Cursor& a, const Cursor& b) {
+    return shards_[b.first][b.second] < shards_[a.first][a.second];
+  };
+  std::priority_queue< Cursor, std::vector< Cursor >, decltype(later) >
+    heads(later);
+  const std::vector< size_t >& ends = range_starts_[range + 1];
+  for (size_t i = 0; i < thread_tot_; ++i) {
+    if (range_starts_[range][i] < ends[i]) {
+      heads.push(Cursor(i, range_starts_[range][i]));
+    }
+  }
+
+  std::vector< std::string >& part = parts_[range];
+  while (!heads.empty()) {
+    Cursor head = heads.top();
+    heads.pop();
+    std::string& key = shards_[head.first][head.second];
+    if (part.empty() || part.back() != key) {
+      part.push_back(std::move(key));
+    }
+    if (++head.second < ends[head.first]) {
+      heads.push(head);
+    }
+  }
+}
+} // namespace anagram
@@ -0,0 +1,100 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "search_limits.h"
+
+namespace anagram {
+
+// Constructor
+// Starts the clock for the time limit.
+// Entry: limits
+SearchBudget::SearchBudget(const SearchLimits& limits)
+{
+  limits_ = limits;
+  clock_gettime(CLOCK_MONOTONIC, &start_);
+  nodes_ = 0;
+  first_result_ms_ = -1;
+  allocations_ = 0;
+  expired_ = false;
+}
+
+// Destructor
+SearchBudget::~SearchBudget()
+{
+}
+
+// Spend
+// Charges nodes to the budget and checks the limits.
+// Entry: # of nodes
+// Exit: false == the budget is spent
+bool SearchBudget::Spend(long nodes)
+{
+  long total = __sync_add_and_fetch(&nodes_, nodes);
+  if (limits_.node_limit && total >= limits_.node_limit) {
+    expired_ = true;
+  }
+  if (limits_.time_limit_ms && !expired_) {
+    if (GetElapsedMs() >= limits_.time_limit_ms) {
+      expired_ = true;
+    }
+  }
+  return !expired_;
+}
+
+// NoteResult
+// Records the time of the first result; later calls have no effect.
+void SearchBudget::NoteResult()
+{
+  if (first_result_ms_ < 0) {
+    __sync_bool_compare_and_swap(&first_result_ms_, -1, GetElapsedMs());
+  }
+}
+
+// NoteAllocations
+// Adds a search thread's heap allocations to the total.
+// Entry: # of allocations (see GetThreadAllocations)
+void SearchBudget::NoteAllocations(long allocations)
+{
+  __sync_fetch_and_add(&allocations_, allocations);
+}
+
+// GetElapsedMs
+// Exit: milliseconds since the budget was created
+long SearchBudget::GetElapsedMs() const
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start_.tv_sec) * 1000 +
+    (now.tv_nsec - start_.tv_nsec) / 1000000;
+}
+
+// GetElapsedUs
+// Exit: microseconds since the budget was created
+long SearchBudget::GetElapsedUs() const
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start_.tv_sec) * 1000000 +
+    (now.tv_nsec - start_.tv_nsec) / 1000;
+}
+} // namespace anagram
@@ -0,0 +1,267 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+#include "anagram_log.h"
+#include "shard_coordinator.h"
+
+namespace anagram {
+
+// Tries at a shard before the search is given up; also the failures in a
+// row after which a worker is no longer used
+const size_t kShardAttempts = 3;
+
+// ShellQuote
+// Entry: argument
+// Exit: the argument quoted for sh, to be passed on as it is
+std::string ShellQuote(const std::string& arg)
+{
+  std::string quoted = "'";
+  for (char c : arg) {
+    if ('\'' == c)
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+}
+
+// Constructor
+// Entry: worker commands, each run by sh with the shard's arguments added
+//        # of shards
+//        options of the search
+//        words of the phrase
+ShardCoordinator::ShardCoordinator(
+  const std::vector< std::string >& commands,
+  size_t shard_tot,
+  const std::vector< std::string >& options,
+  const std::vector< std::string >& phrase)
+{
+  commands_ = commands;
+  shard_tot_ = shard_tot ? shard_tot : 1;
+  options_ = options;
+  phrase_ = phrase;
+}
+
+// Destructor
+ShardCoordinator::~ShardCoordinator()
+{
+}
+
+// Run
+// Runs every shard to the end, handing them out as workers come free.
+// Entry: true == count only (--count): each worker writes its count
+//        true == write the results to stdout as each shard completes
+//        list to add the results to, unless written
+//        count to add to: of results, or the workers' counts
+// Exit: true == every shard completed
+bool ShardCoordinator::Run(
+  bool count_only,
+  bool output_directly,
+  std::vector< std::string > *lines,
+  size_t *count)
+{
+  pending_.clear();
+  for (size_t i = 0; i < shard_tot_; ++i) {
+    pending_.push_back(i);
+  }
+  attempts_.assign(shard_tot_, 0);
+  std::vector< bool > busy(commands_.size(), false);   // or given up
+  std::vector< size_t > failures(commands_.size(), 0);   // in a row
+  std::vector< char > buffer(1 << 16);
+  std::vector< struct pollfd > fds;
+  bool ok = true;
+  while (!running_.empty() || (ok && !pending_.empty())) {
+    for (size_t w = 0; w < commands_.size() && ok; ++w) {
+      if (busy[w] || pending_.empty())
+        continue;
+      size_t shard = pending_.front();
+      pending_.pop_front();
+      ok = Start(w, shard);
+      busy[w] = ok;
+    }
+    if (running_.empty())
+      break;
+
+    fds.resize(running_.size());
+    for (size_t i = 0; i < running_.size(); ++i) {
+      fds[i].fd = running_[i].fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0)
+      continue;   // interrupted
+    for (size_t i = running_.size(); i-- > 0; ) {
+      if (!fds[i].revents)
+        continue;
+      Running& running = running_[i];
+      ssize_t got = read(running.fd, buffer.data(), buffer.size());
+      if (got > 0) {
+        fwrite(buffer.data(), 1, (size_t) got, running.spool);
+        continue;
+      }
+      if (got < 0 && EINTR == errno)
+        continue;
+
+      // The worker is through: keep its shard, or hand it out again
+      int status = 0;
+      close(running.fd);
+      waitpid(running.pid, &status, 0);
+      busy[running.worker] = false;
+      if (WIFEXITED(status) && !WEXITSTATUS(status) &&
+          Collect(&running, count_only, output_directly, lines, count)) {
+        failures[running.worker] = 0;
+        VERBOSE_LOG(LOG_INFO, "\rShard " << running.shard << " of "
+          << shard_tot_ << " done" << std::endl);
+      } else {
+        if (++failures[running.worker] >= kShardAttempts) {
+          VERBOSE_LOG(LOG_NORMAL, "\rGiving up on worker: "
+            << commands_[running.worker] << std::endl);
+          busy[running.worker] = true;
+        }
+        if (++attempts_[running.shard] < kShardAttempts) {
+          VERBOSE_LOG(LOG_NORMAL, "\rShard " << running.shard
+            << " failed; trying again" << std::endl);
+          pending_.push_back(running.shard);
+        } else {
+          VERBOSE_LOG(LOG_NONE, "\rShard " << running.shard << " failed: "
+            << GetCommand(running.worker, running.shard) << std::endl);
+          ok = false;
+        }
+      }
+      fclose(running.spool);
+      running_.erase(running_.begin() + i);
+    }
+  }
+  return ok && pending_.empty();
+}
+
+// Start
+// Starts a worker on a shard, its output to a pipe.
+// Entry: index of the worker command
+//        shard
+// Exit: true == started
+bool ShardCoordinator::Start(size_t worker, size_t shard)
+{
+  Running running;
+  running.shard = shard;
+  running.worker = worker;
+  running.spool = tmpfile();
+  int pipe_fds[2];
+  if (!running.spool) {
+    VERBOSE_LOG(LOG_NONE, "Cannot spool shard output" << std::endl);
+    return false;
+  }
+  if (pipe(pipe_fds)) {
+    fclose(running.spool);
+    VERBOSE_LOG(LOG_NONE, "Cannot open pipe to worker" << std::endl);
+    return false;
+  }
+  fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+  std::string command = GetCommand(worker, shard);
+  fflush(stdout);
+  running.pid = fork();
+  if (!running.pid) {
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    close(pipe_fds[1]);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char *) nullptr);
+    _exit(127);
+  }
+  close(pipe_fds[1]);
+  if (running.pid < 0) {
+    close(pipe_fds[0]);
+    fclose(running.spool);
+    VERBOSE_LOG(LOG_NONE, "Cannot start worker" << std::endl);
+    return false;
+  }
+  running.fd = pipe_fds[0];
+  running_.push_back(running);
+  return true;
+}
+
+// Collect
+// Takes the output of a completed shard.
+// Entry: the shard's worker
+//        true == the output is a count (--count)
+//        true == write the output to stdout
+//        list to add the output's lines to, unless written
+//        count to add to
+// Exit: true == the output was read
+bool ShardCoordinator::Collect(
+  Running *running,
+  bool count_only,
+  bool output_directly,
+  std::vector< std::string > *lines,
+  size_t *count)
+{
+  rewind(running->spool);
+  if (count_only) {
+    unsigned long long shard_count = 0;
+    if (1 != fscanf(running->spool, "%llu", &shard_count))
+      return false;
+    *count += (size_t) shard_count;
+    return true;
+  }
+  char *line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, running->spool)) > 0) {
+    if (output_directly) {
+      fwrite(line, 1, (size_t) length, stdout);
+    } else {
+      if ('\n' == line[length - 1])
+        --length;
+      lines->push_back(std::string(line, (size_t) length));
+    }
+    ++*count;
+  }
+  free(line);
+  return true;
+}
+
+// GetCommand
+// Entry: index of the worker command
+//        shard
+// Exit: the command line that runs the shard: the worker command, then
+//       the search's options, quiet and writing directly, then the phrase
+std::string ShardCoordinator::GetCommand(size_t worker, size_t shard) const
+{
+  std::string command = commands_[worker];
+  for (const auto& option : options_) {
+    command += " " + ShellQuote(option);
+  }
+  command += " -v0 -o --shard=" + std::to_string(shard) + "/" +
+    std::to_string(shard_tot_);
+  for (const auto& word : phrase_) {
+    command += " " + ShellQuote(word);
+  }
+  return command;
+}
+} // namespace anagram
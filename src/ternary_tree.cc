@@ -32,6 +32,9 @@
 #include <stack>
 #include <queue>
 #include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
 #include "templ_node.h"
 #include "ternary_tree.h"
 #include "anagram_log.h"
@@ -74,8 +77,9 @@ TNode *TernaryTree::GetRoot()
 //
 // @In: word pointer to null-terminated string
 // ppParent pointer to parent pointer
+// weight of the word, for Complete; a word inserted twice keeps the higher
 // @Out: Node *
-TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
+TNode * TernaryTree::Insert(const char *word, TNode **ppNode, unsigned weight)
 {
   TNode * pChild = NULL;
   //VERBOSE_LOG(LOG_DEBUG, "Insert >>>>>" << std::endl);
@@ -83,22 +87,22 @@ TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
     *ppNode = AllocNode(*word);
     //VERBOSE_LOG(LOG_DEBUG, "ALLOC" << std::endl);
   }
-  if (tolower(*word) < ((*ppNode)->GetKey())) {
+  if (tolower((UCHAR) *word) < ((*ppNode)->GetKey())) {
     //VERBOSE_LOG(LOG_DEBUG,  "L: " << word);
-    Insert(word, &((*ppNode)->l_));
+    Insert(word, &((*ppNode)->l_), weight);
     (*ppNode)->GetLeft()->SetParent((*ppNode)->GetParent());
   }
-  else if (tolower(*word) > (*ppNode)->GetKey()) {
+  else if (tolower((UCHAR) *word) > (*ppNode)->GetKey()) {
     //VERBOSE_LOG(LOG_DEBUG,  "R: " << word << std::endl);
     // Add a peer on the right
-    Insert(word, &((*ppNode)->r_));
+    Insert(word, &((*ppNode)->r_), weight);
     (*ppNode)->GetRight()->SetParent((*ppNode)->GetParent());
   } else {
     // Is this the last letter (is there a char in the second position?)
     if (word[ 1 ])
     {
       //VERBOSE_LOG(LOG_DEBUG,  "C: " << word << std::endl);
-      pChild = Insert(word + 1, &((*ppNode)->c_));
+      pChild = Insert(word + 1, &((*ppNode)->c_), weight);
       pChild->SetParent(*ppNode);
     }
     else
@@ -106,6 +110,8 @@ TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
       // Yep, last letter, so we will set the terminator flag...
       //VERBOSE_LOG(LOG_DEBUG,  "T: " << word << std::endl);
       (*ppNode)->SetTerminator();
+      if (weight > (*ppNode)->GetWeight())
+        (*ppNode)->SetWeight(weight);
     }
   }
 
@@ -136,9 +142,9 @@ bool TernaryTree::Find(const char *word, TNode *pParent, TNode ** ppTerminal)
   bool ret = false;
   if (pParent)
   {
-    if ((*word) < pParent->GetKey())
+    if ((UCHAR) (*word) < pParent->GetKey())
       ret = Find(word, pParent->GetLeft(), ppTerminal);
-    else if ((*word) > pParent->GetKey())
+    else if ((UCHAR) (*word) > pParent->GetKey())
       ret = Find(word, pParent->GetRight(), ppTerminal);
     else
     {
@@ -346,6 +352,299 @@ bool TernaryTree::Extrapolate(
   return ret;
 }
 
+// PatternFind
+// Finds the words matching a crossword-style pattern, in which ? stands
+// for any one letter and * for any run of letters, including none.  Fixed
+// letters follow the same path as Find; only a wildcard branches, and
+// then only over the peers at its own position.  Spaces are never
+// wildcard letters, so words of a phrase are matched separately.
+//
+// @In:     @pattern pointer to null-terminated pattern (lowercase)
+//          @pParent pointer to current parent node
+//          @rack letters the wildcards may stand for, each used at most
+//          once; nullptr == any letters
+// @Out:    @words filled with the matching words, sorted
+void TernaryTree::PatternFind(
+    const char *pattern,
+    TNode *pParent,
+    const char *rack,
+    std::vector< std::string > *words)
+{
+  words->clear();
+  if (!pattern || !*pattern)
+    return;
+  int rack_counts[256] = { 0 };
+  if (rack) {
+    for (const char *p = rack; *p; ++p)
+      ++rack_counts[(UCHAR) tolower((UCHAR) *p)];
+  }
+  std::string accum;
+  MatchPattern(pParent, pattern, 0, rack ? rack_counts : nullptr, &accum,
+    words);
+
+  // * can match the same letters more than one way, as in "a**"
+  std::sort(words->begin(), words->end());
+  words->erase(std::unique(words->begin(), words->end()), words->end());
+}
+
+// OnlyStars
+// Whether what is left of a pattern can match nothing at all.
+// @In:     @pattern pointer to null-terminated pattern
+// @Out:    true == nothing but *s remain
+static bool OnlyStars(const char *pattern)
+{
+  while ('*' == *pattern)
+    ++pattern;
+  return !*pattern;
+}
+
+// Utf8Tail
+// # of continuation bytes following a UTF-8 lead byte, so a wildcard
+// takes a whole character.
+// @In:     @key lead byte
+// @Out:    0..3
+static size_t Utf8Tail(UCHAR key)
+{
+  if (key >= 0xf0)
+    return 3;
+  if (key >= 0xe0)
+    return 2;
+  if (key >= 0xc0)
+    return 1;
+  return 0;
+}
+
+// MatchPattern
+// Matches the pattern at one position, among a node and its left/right
+// peers.
+//
+// @In:     @node first node of the position's peers
+//          @pattern pointer to what is left of the pattern
+//          @pending # of continuation bytes a wildcard still has to take
+//          @rack letters the wildcards have left, by byte (a wildcard
+//          standing for a UTF-8 letter takes each of its bytes); nullptr ==
+//          any
+//          @accum the word so far
+// @Out:    @words matches appended
+void TernaryTree::MatchPattern(
+    TNode *node,
+    const char *pattern,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words)
+{
+  if (!node)
+    return;
+  if (pending) {
+    MatchLevel(node, pattern, pending, rack, accum, words);
+    return;
+  }
+  switch (*pattern) {
+    case '\0':
+      break;
+    case '*':
+      // Matches nothing, or takes a letter and stays
+      if (pattern[1])
+        MatchPattern(node, pattern + 1, 0, rack, accum, words);
+      MatchLevel(node, pattern, 0, rack, accum, words);
+      break;
+    case '?':
+      MatchLevel(node, pattern + 1, 0, rack, accum, words);
+      break;
+    default: {
+        // A fixed letter: down the peers as Find does
+        UCHAR key = (UCHAR) *pattern;
+        while (node && key != node->GetKey())
+          node = key < node->GetKey() ? node->GetLeft() : node->GetRight();
+        if (node) {
+          // Fixed letters are on the board already, so take no rack letter
+          TakeNode(node, pattern + 1, 0, rack, accum, words);
+        }
+      }
+      break;
+  }
+}
+
+// MatchLevel
+// Lets a wildcard take each of a node and its left/right peers in turn.
+//
+// @In:     @node node at the wildcard's position
+//          @rest pointer to the pattern after the wildcard
+//          @pending # of continuation bytes the wildcard still has to
+//          take; 0 == a new letter
+//          @rack, @accum as for MatchPattern
+// @Out:    @words matches appended
+void TernaryTree::MatchLevel(
+    TNode *node,
+    const char *rest,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words)
+{
+  if (!node)
+    return;
+  MatchLevel(node->GetLeft(), rest, pending, rack, accum, words);
+  UCHAR key = node->GetKey();
+  bool continuation = 0x80 == (key & 0xc0);
+  bool letter = pending ? continuation : ' ' != key && key && !continuation;
+  if (letter && (!rack || rack[key])) {
+    if (rack)
+      --rack[key];
+    TakeNode(node, rest, pending ? pending - 1 : Utf8Tail(key), rack, accum,
+      words);
+    if (rack)
+      ++rack[key];
+  }
+  MatchLevel(node->GetRight(), rest, pending, rack, accum, words);
+}
+
+// TakeNode
+// Adds a node's letter to the word, which is a match if the node ends a
+// word and the pattern is used up, and goes on to the next position.
+//
+// @In:     @node node taken
+//          @rest pointer to what is left of the pattern
+//          @pending, @rack, @accum as for MatchPattern
+// @Out:    @words matches appended
+void TernaryTree::TakeNode(
+    TNode *node,
+    const char *rest,
+    size_t pending,
+    int *rack,
+    std::string *accum,
+    std::vector< std::string > *words)
+{
+  accum->push_back(node->GetKey());
+  if (!pending && node->GetTerminator() && OnlyStars(rest))
+    words->push_back(*accum);
+  if (pending || *rest)
+    MatchPattern(node->GetCenter(), rest, pending, rack, accum, words);
+  accum->pop_back();
+}
+
+// UpdateBest
+// Stores in each node the highest weight of the words in its subtree, and
+// the length of the shortest of those counted from the node's own
+// position, so that Complete can go straight to the best completions.
+// Call once the words are all inserted.
+//
+// @In:     @node root of the (sub)tree
+void TernaryTree::UpdateBest(TNode *node)
+{
+  if (!node)
+    return;
+  unsigned best = 0;
+  unsigned shortest = kNoCompletion;
+  // Takes a word, or the best of a subtree, if it beats those so far
+  auto consider = [&best, &shortest](unsigned weight, unsigned length) {
+    if (kNoCompletion == shortest || weight > best ||
+        (weight == best && length < shortest)) {
+      best = weight;
+      shortest = length;
+    }
+  };
+  if (node->GetTerminator())
+    consider(node->GetWeight(), 1);
+  TNode *center = node->GetCenter();
+  UpdateBest(center);
+  if (center && kNoCompletion != center->GetShortest())
+    consider(center->GetBest(),
+      std::min(center->GetShortest() + 1u, kNoCompletion - 1u));
+  TNode *peers[] = { node->GetLeft(), node->GetRight() };
+  for (TNode *peer : peers) {
+    UpdateBest(peer);
+    if (peer && kNoCompletion != peer->GetShortest())
+      consider(peer->GetBest(), peer->GetShortest());
+  }
+  node->SetBest(best, (UCHAR) shortest);
+}
+
+// Completion
+// A word, or a subtree of words, waiting to be listed by Complete.  A
+// subtree is ranked by its best word (see UpdateBest) and the prefix all
+// its words share, which no word in it can come before.
+struct Completion {
+  unsigned weight;      // of the word; highest in the subtree
+  size_t length;        // of the word; shortest of that weight
+  std::string text;     // the word; the subtree's prefix
+  TNode *node;          // subtree; nullptr == a word
+
+  bool operator>(const Completion& other) const {
+    if (weight != other.weight)
+      return weight < other.weight;
+    if (length != other.length)
+      return length > other.length;
+    if (text != other.text)
+      return text > other.text;
+    return node && !other.node;   // words first
+  }
+};
+
+// Complete
+// Finds the k best completions of a prefix: the words that start with it,
+// highest weight first (see ReadDictionaryFile), then shortest first, in
+// alphabetical order among words of a weight and length.  The subtrees
+// are searched best first by their best word (see UpdateBest), so the
+// time taken depends on k and the word length and not on how many words
+// share the prefix.
+//
+// @In:     @prefix pointer to null-terminated prefix (lowercase); empty
+//          == any word
+//          @pParent pointer to current parent node
+//          @k # of completions wanted
+// @Out:    @words filled with up to k completions, best first
+void TernaryTree::Complete(
+    const char *prefix,
+    TNode *pParent,
+    size_t k,
+    std::vector< std::string > *words)
+{
+  words->clear();
+  std::priority_queue< Completion, std::vector< Completion >,
+    std::greater< Completion > > queue;
+  std::string stem = prefix ? prefix : "";
+  if (stem.empty()) {
+    if (pParent && kNoCompletion != pParent->GetShortest())
+      queue.push({ pParent->GetBest(), pParent->GetShortest(), stem,
+        pParent });
+  } else {
+    TNode *node = nullptr;
+    if (Find(stem.c_str(), pParent, &node))
+      queue.push({ node->GetWeight(), stem.length(), stem, nullptr });
+    TNode *center = node ? node->GetCenter() : nullptr;
+    if (center && kNoCompletion != center->GetShortest())
+      queue.push({ center->GetBest(), stem.length() + center->GetShortest(),
+        stem, center });
+  }
+
+  while (!queue.empty() && words->size() < k) {
+    Completion best = queue.top();
+    queue.pop();
+    TNode *node = best.node;
+    if (!node) {
+      words->push_back(best.text);
+      continue;
+    }
+    // Split the subtree into its peers, its word and what follows it
+    size_t depth = best.text.length();
+    TNode *peers[] = { node->GetLeft(), node->GetRight() };
+    for (TNode *peer : peers) {
+      if (peer && kNoCompletion != peer->GetShortest())
+        queue.push({ peer->GetBest(), depth + peer->GetShortest(), best.text,
+          peer });
+    }
+    std::string text = best.text + (char) node->GetKey();
+    if (node->GetTerminator())
+      queue.push({ node->GetWeight(), depth + 1, text, nullptr });
+    TNode *center = node->GetCenter();
+    if (center && kNoCompletion != center->GetShortest())
+      queue.push({ center->GetBest(), depth + 1 + center->GetShortest(), text,
+        center });
+  }
+}
+
 // AllocNode
 // Insert a node into the tree
 // Entry: key
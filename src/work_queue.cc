@@ -0,0 +1,132 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Greg Hedger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "work_queue.h"
+
+namespace anagram {
+
+// Constructor
+// Entry: # of worker threads
+WorkStealingQueue::WorkStealingQueue(size_t thread_tot)
+{
+  thread_tot_ = thread_tot ? thread_tot : 1;
+  deques_ = new TaskDeque[thread_tot_];
+  for (size_t i = 0; i < thread_tot_; ++i) {
+    deques_[i].idle = false;
+  }
+  pending_ = 0;
+  idle_ = 0;
+}
+
+// Destructor
+WorkStealingQueue::~WorkStealingQueue()
+{
+  delete [] deques_;
+}
+
+// Push
+// Adds a task to the back of a thread's own deque.
+// Entry: index of the pushing (owning) thread
+//        task
+void WorkStealingQueue::Push(size_t thread_index, const SearchTask& task)
+{
+  TaskDeque& own = deques_[thread_index % thread_tot_];
+  __sync_fetch_and_add(&pending_, 1);
+  own.lock.Acquire();
+  own.tasks.push_back(task);
+  own.lock.Release();
+}
+
+// Pop
+// Takes the most recent task from the thread's own deque, or steals the
+// oldest task of another thread if it has none.
+// Entry: index of the calling thread
+//        pointer to task to fill in
+// Exit: true == task returned; caller must call Done when it completes
+bool WorkStealingQueue::Pop(size_t thread_index, SearchTask *task)
+{
+  TaskDeque& own = deques_[thread_index];
+  bool found = false;
+  own.lock.Acquire();
+  if (!own.tasks.empty()) {
+    *task = own.tasks.back();
+    own.tasks.pop_back();
+    found = true;
+  }
+  own.lock.Release();
+
+  if (!found)
+    found = Steal(thread_index, task);
+
+  // Track idle threads so that busy ones know to split their work.
+  if (found && own.idle) {
+    own.idle = false;
+    __sync_fetch_and_sub(&idle_, 1);
+  } else if (!found && !own.idle) {
+    own.idle = true;
+    __sync_fetch_and_add(&idle_, 1);
+  }
+  return found;
+}
+
+// Steal
+// Takes the oldest task from the first other thread that has one, starting
+// with the next thread along to spread thieves out.
+// Entry: index of the calling thread
+//        pointer to task to fill in
+// Exit: true == task stolen
+bool WorkStealingQueue::Steal(size_t thread_index, SearchTask *task)
+{
+  for (size_t i = 1; i < thread_tot_; ++i) {
+    TaskDeque& victim = deques_[(thread_index + i) % thread_tot_];
+    bool found = false;
+    victim.lock.Acquire();
+    if (!victim.tasks.empty()) {
+      *task = victim.tasks.front();
+      victim.tasks.pop_front();
+      found = true;
+    }
+    victim.lock.Release();
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+// Done
+// Marks a popped task as complete.  Any tasks it pushed were counted before
+// this, so pending_ only reaches zero when all work is finished.
+void WorkStealingQueue::Done()
+{
+  __sync_fetch_and_sub(&pending_, 1);
+}
+
+// Hold
+// Keeps the work from finishing, as a task would, until a matching Done:
+// for tasks that are still to be pushed after the threads have started
+// taking them.
+void WorkStealingQueue::Hold()
+{
+  __sync_fetch_and_add(&pending_, 1);
+}
+} // namespace anagram